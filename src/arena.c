@@ -0,0 +1,87 @@
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "xmalloc.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arena_block {
+	struct arena_block *next;
+	size_t used;
+	size_t size;
+	alignas(max_align_t) char data[];
+};
+
+static struct arena_block *arena_block_create(size_t size)
+{
+	struct arena_block *block = xmalloc(sizeof(*block) + size);
+	block->next = NULL;
+	block->used = 0;
+	block->size = size;
+	return block;
+}
+
+void arena_destroy(struct arena *arena)
+{
+	struct arena_block *block = arena->head;
+	while (block) {
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->head = NULL;
+}
+
+static void *arena_bump(struct arena *arena, size_t size, size_t align)
+{
+	struct arena_block *block = arena->head;
+	if (block) {
+		size_t offset = (block->used + align - 1) & ~(align - 1);
+		if (offset <= block->size && block->size - offset >= size) {
+			block->used = offset + size;
+			return block->data + offset;
+		}
+	}
+
+	if (size > ARENA_BLOCK_SIZE / 4) {
+		/*
+		 * Large allocations get a block of their own, slotted in
+		 * behind the current one so we don't waste its free space.
+		 */
+		struct arena_block *large = arena_block_create(size);
+		large->used = size;
+		if (block) {
+			large->next = block->next;
+			block->next = large;
+		} else {
+			arena->head = large;
+		}
+		return large->data;
+	}
+
+	block = arena_block_create(ARENA_BLOCK_SIZE);
+	block->next = arena->head;
+	block->used = size;
+	arena->head = block;
+	return block->data;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	return arena_bump(arena, size, alignof(max_align_t));
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t len)
+{
+	/* Strings don't need any alignment, so pack them tightly. */
+	char *copy = arena_bump(arena, len + 1, 1);
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+	return arena_strndup(arena, str, strlen(str));
+}
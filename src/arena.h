@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A simple bump allocator. Memory is handed out from a chain of blocks and
+ * only released all at once by arena_destroy(), so pointers into an arena
+ * stay valid for its whole lifetime.
+ *
+ * A zero-initialised struct arena is ready to use.
+ */
+struct arena_block;
+
+struct arena {
+	struct arena_block *head;
+};
+
+void arena_destroy(struct arena *arena);
+
+[[gnu::malloc]]
+void *arena_alloc(struct arena *arena, size_t size);
+
+[[gnu::malloc]]
+char *arena_strdup(struct arena *arena, const char *str);
+
+[[gnu::malloc]]
+char *arena_strndup(struct arena *arena, const char *str, size_t len);
+
+#endif /* ARENA_H */
@@ -8,6 +8,9 @@
 static struct desktop_vec cached_apps = {0};
 static bool apps_loaded = false;
 
+/* All apps share one action, which launches the selected app's id. */
+static struct action_def *apps_action = NULL;
+
 bool builtin_is_builtin(const char *cmd)
 {
 	return cmd && cmd[0] == '@';
@@ -21,33 +24,38 @@ static void ensure_apps_loaded(void)
 	}
 }
 
-static void builtin_list_apps(struct wl_list *results)
+static void builtin_list_apps(struct wl_list *results, struct arena *arena)
 {
 	ensure_apps_loaded();
 	
+	if (!apps_action) {
+		apps_action = action_def_create();
+		strncpy(apps_action->as, "app_id", NAV_KEY_MAX - 1);
+		strncpy(apps_action->template, "@launch {app_id}", NAV_TEMPLATE_MAX - 1);
+		action_def_compile(apps_action);
+	}
+	
 	for (size_t i = 0; i < cached_apps.count; i++) {
 		struct desktop_entry *app = &cached_apps.buf[i];
 		
-		struct nav_result *res = nav_result_create();
-		strncpy(res->label, app->name, NAV_LABEL_MAX - 1);
-		strncpy(res->value, app->id, NAV_VALUE_MAX - 1);
-		strncpy(res->source_plugin, "apps", NAV_NAME_MAX - 1);
-		res->action.selection_type = SELECTION_SELF;
-		res->action.execution_type = EXECUTION_EXEC;
-		snprintf(res->action.template, NAV_TEMPLATE_MAX - 1, "@launch %s", app->id);
+		struct nav_result *res = nav_result_create(arena);
+		res->label = arena_strdup(arena, app->name);
+		res->value = arena_strdup(arena, app->id);
+		res->source_plugin = "apps";
+		res->action = apps_action;
 		
 		wl_list_insert(results, &res->link);
 	}
 }
 
-void builtin_run_list_cmd(const char *cmd, struct wl_list *results)
+void builtin_run_list_cmd(const char *cmd, struct wl_list *results, struct arena *arena)
 {
 	if (!cmd || !cmd[0]) {
 		return;
 	}
 	
 	if (strcmp(cmd, "@apps") == 0) {
-		builtin_list_apps(results);
+		builtin_list_apps(results, arena);
 		return;
 	}
 	
@@ -93,4 +101,6 @@ void builtin_cleanup(void)
 		desktop_vec_destroy(&cached_apps);
 		apps_loaded = false;
 	}
+	action_def_unref(apps_action);
+	apps_action = NULL;
 }
@@ -3,11 +3,12 @@
 
 #include <stdbool.h>
 #include <wayland-client.h>
+#include "arena.h"
 #include "nav.h"
 
 bool builtin_is_builtin(const char *cmd);
 
-void builtin_run_list_cmd(const char *cmd, struct wl_list *results);
+void builtin_run_list_cmd(const char *cmd, struct wl_list *results, struct arena *arena);
 
 bool builtin_execute(const char *cmd, struct value_dict *dict);
 
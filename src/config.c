@@ -349,6 +349,11 @@ bool parse_option(struct tofi *tofi, const char *filename, size_t lineno, const
 		if (!err) {
 			tofi->window.entry.accent_color = val;
 		}
+	} else if (strcasecmp(option, "selection-match-color") == 0) {
+		struct color val = parse_color(filename, lineno, value, &err);
+		if (!err) {
+			tofi->window.entry.selection_highlight_color = val;
+		}
 	} else if (strcasecmp(option, "width") == 0) {
 		percent = parse_uint32_percent(filename, lineno, value, &err);
 		if (!err) {
@@ -385,6 +390,11 @@ bool parse_option(struct tofi *tofi, const char *filename, size_t lineno, const
 			tofi->window.margin_right = percent.value;
 			tofi->window.margin_right_is_percent = percent.percent;
 		}
+	} else if (strcasecmp(option, "parallel-filter-threshold") == 0) {
+		uint32_t val = parse_uint32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->parallel_filter_threshold = val;
+		}
 	} else if (strcasecmp(option, "padding") == 0) {
 		uint32_t val = parse_uint32(filename, lineno, value, &err);
 		if (!err) {
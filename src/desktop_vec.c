@@ -4,6 +4,7 @@
 #include "matching.h"
 #include "log.h"
 #include "string_vec.h"
+#include "threadpool.h"
 #include "unicode.h"
 #include "xmalloc.h"
 
@@ -27,6 +28,9 @@ void desktop_vec_destroy(struct desktop_vec *restrict vec)
 		free(vec->buf[i].name);
 		free(vec->buf[i].path);
 		free(vec->buf[i].keywords);
+		free(vec->buf[i].name_key);
+		free(vec->buf[i].name_key_map);
+		free(vec->buf[i].keywords_key);
 	}
 	free(vec->buf);
 }
@@ -49,6 +53,20 @@ void desktop_vec_add(
 	}
 	vec->buf[vec->count].path = xstrdup(path);
 	vec->buf[vec->count].keywords = xstrdup(keywords);
+	vec->buf[vec->count].name_key = utf8_fold(vec->buf[vec->count].name);
+	vec->buf[vec->count].name_key_map = NULL;
+	if (vec->buf[vec->count].name_key != NULL) {
+		vec->buf[vec->count].name_key_map = match_key_map(
+				vec->buf[vec->count].name,
+				vec->buf[vec->count].name_key);
+	}
+	vec->buf[vec->count].keywords_key = utf8_fold(keywords);
+	vec->buf[vec->count].name_mask = match_mask(
+			vec->buf[vec->count].name,
+			vec->buf[vec->count].name_key);
+	vec->buf[vec->count].keywords_mask = match_mask(
+			keywords,
+			vec->buf[vec->count].keywords_key);
 	vec->buf[vec->count].search_score = 0;
 	vec->buf[vec->count].history_score = 0;
 	vec->count++;
@@ -122,16 +140,6 @@ static int cmpdesktopp(const void *restrict a, const void *restrict b)
 	return strcmp(d1->name, d2->name);
 }
 
-static int cmpscorep(const void *restrict a, const void *restrict b)
-{
-	struct scored_string *restrict str1 = (struct scored_string *)a;
-	struct scored_string *restrict str2 = (struct scored_string *)b;
-
-	int hist_diff = str2->history_score - str1->history_score;
-	int search_diff = str2->search_score - str1->search_score;
-	return hist_diff + search_diff;
-}
-
 void desktop_vec_sort(struct desktop_vec *restrict vec)
 {
 	qsort(vec->buf, vec->count, sizeof(vec->buf[0]), cmpdesktopp);
@@ -147,39 +155,85 @@ struct desktop_entry *desktop_vec_find_sorted(struct desktop_vec *restrict vec,
 	return bsearch(&tmp, vec->buf, vec->count, sizeof(vec->buf[0]), cmpdesktopp);
 }
 
-struct string_ref_vec desktop_vec_filter(
-		const struct desktop_vec *restrict vec,
-		const char *restrict substr,
-		enum matching_algorithm algorithm)
+/*
+ * State shared by each chunk of a (possibly multi-threaded) filter. Each chunk
+ * writes its matches to its own vector, which are then merged in order.
+ */
+struct filter_job {
+	const struct desktop_vec *vec;
+	const struct compiled_query *query;
+	struct string_ref_vec *results;
+};
+
+static void filter_chunk(void *data, size_t chunk, size_t start, size_t end)
 {
-	struct string_ref_vec filt = string_ref_vec_create();
-	for (size_t i = 0; i < vec->count; i++) {
-		int32_t search_score;
-		search_score = match_words(algorithm, substr, vec->buf[i].name);
+	struct filter_job *job = data;
+	const struct compiled_query *query = job->query;
+	const matcher_fn match = query->match;
+	struct string_ref_vec *filt = &job->results[chunk];
+	for (size_t i = start; i < end; i++) {
+		const struct desktop_entry *app = &job->vec->buf[i];
+		int32_t search_score = INT32_MIN;
+		if (match_mask_possible(app->name_mask, query->mask)) {
+			search_score = match(query, app->name, app->name_key, NULL, NULL);
+		}
 		if (search_score != INT32_MIN) {
-			string_ref_vec_add(&filt, vec->buf[i].name);
+			string_ref_vec_add_keyed(filt, app->name, app->name_key, app->name_key_map, app->name_mask);
 			/* Store the score of the match for later sorting. */
-			filt.buf[filt.count - 1].search_score = search_score;
-			filt.buf[filt.count - 1].history_score = vec->buf[i].history_score;
-		} else {
+			filt->buf[filt->count - 1].search_score = search_score;
+			filt->buf[filt->count - 1].history_score = app->history_score;
+		} else if (match_mask_possible(app->keywords_mask, query->mask)) {
 			/* If we didn't match the name, check the keywords. */
-			search_score = match_words(algorithm, substr, vec->buf[i].keywords);
+			search_score = match(query, app->keywords, app->keywords_key, NULL, NULL);
 			if (search_score != INT32_MIN) {
-				string_ref_vec_add(&filt, vec->buf[i].name);
+				string_ref_vec_add_keyed(filt, app->name, app->name_key, app->name_key_map, app->name_mask);
 				/*
 				 * Arbitrary score addition to make name
 				 * matches preferred over keyword matches.
 				 */
-				filt.buf[filt.count - 1].search_score = search_score - 20;
-				filt.buf[filt.count - 1].history_score = vec->buf[i].history_score;
+				filt->buf[filt->count - 1].search_score = search_score - 20;
+				filt->buf[filt->count - 1].history_score = app->history_score;
 			}
 		}
 	}
+}
+
+struct string_ref_vec desktop_vec_filter(
+		const struct desktop_vec *restrict vec,
+		const char *restrict substr,
+		enum matching_algorithm algorithm)
+{
+	size_t chunks = threadpool_chunks(vec->count);
+	struct string_ref_vec single;
+	struct string_ref_vec *results = &single;
+	if (chunks > 1) {
+		results = xcalloc(chunks, sizeof(*results));
+	}
+	for (size_t i = 0; i < chunks; i++) {
+		results[i] = string_ref_vec_create();
+	}
+
+	struct compiled_query query = compiled_query_create(algorithm, substr);
+	struct filter_job job = {
+		.vec = vec,
+		.query = &query,
+		.results = results,
+	};
+	threadpool_run(vec->count, chunks, filter_chunk, &job);
+	compiled_query_destroy(&query);
+
+	struct string_ref_vec filt = single;
+	if (chunks > 1) {
+		filt = string_ref_vec_merge(results, chunks);
+		free(results);
+	}
+
 	/*
-	 * Sort the results by this search_score. This moves matches at the beginnings
-	 * of words to the front of the result list.
+	 * The results are ranked by search_score lazily, with
+	 * string_ref_vec_rank(). This moves matches at the beginnings of words
+	 * to the front of the result list.
 	 */
-	qsort(filt.buf, filt.count, sizeof(filt.buf[0]), cmpscorep);
+	filt.sorted = 0;
 	return filt;
 }
 
@@ -12,6 +12,12 @@ struct desktop_entry {
 	char *name;
 	char *path;
 	char *keywords;
+	/* Pre-folded copies of name and keywords, and their masks, used for matching. */
+	char *name_key;
+	uint32_t *name_key_map;
+	char *keywords_key;
+	uint64_t name_mask;
+	uint64_t keywords_mask;
 	uint32_t search_score;
 	uint32_t history_score;
 };
@@ -223,6 +223,7 @@ void entry_destroy(struct entry *entry)
 	cairo_destroy(entry->cairo[1].cr);
 	cairo_surface_destroy(entry->cairo[0].surface);
 	cairo_surface_destroy(entry->cairo[1].surface);
+	match_spans_destroy(&entry->highlight_spans);
 }
 
 void entry_update(struct entry *entry)
@@ -238,6 +239,21 @@ void entry_update(struct entry *entry)
 	cairo_paint(cr);
 	cairo_restore(cr);
 
+	/*
+	 * Filtering only scores results, so the characters to highlight are
+	 * found while drawing, for just the results on screen. Nav levels are
+	 * always filtered fuzzily.
+	 */
+	bool highlight = entry->highlight_matches
+		&& entry->selection_highlight_color.a != 0
+		&& entry->input_utf8[0] != '\0';
+	if (highlight) {
+		bool commands = entry->results == &entry->commands || entry->results == &entry->filtered;
+		entry->highlight_query = compiled_query_create(
+				commands ? entry->filter.session.algorithm : MATCHING_ALGORITHM_FUZZY,
+				entry->input_utf8);
+	}
+
 	/* Draw our text. */
 	if (entry->use_pango) {
 		entry_backend_pango_update(entry);
@@ -245,7 +261,28 @@ void entry_update(struct entry *entry)
 		entry_backend_harfbuzz_update(entry);
 	}
 
+	if (highlight) {
+		compiled_query_destroy(&entry->highlight_query);
+	}
+	entry->highlight_query = (struct compiled_query){ 0 };
+
 	log_debug("Finish rendering entry.\n");
 
 	entry->index = !entry->index;
 }
+
+size_t entry_result_spans(
+		struct entry *entry,
+		const struct scored_string_ref *result,
+		const struct match_span **spans)
+{
+	struct match_spans *buf = &entry->highlight_spans;
+	buf->count = 0;
+	*spans = buf->buf;
+	if (entry->highlight_query.num_words == 0) {
+		return 0;
+	}
+	match_words_spans(&entry->highlight_query, result->string, result->key, result->key_map, buf);
+	*spans = buf->buf;
+	return buf->count;
+}
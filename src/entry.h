@@ -7,6 +7,7 @@
 #include <cairo/cairo.h>
 #include <uchar.h>
 #include "color.h"
+#include "filter.h"
 #include "surface.h"
 #include "string_vec.h"
 
@@ -52,10 +53,30 @@ struct entry {
 
 	uint32_t selection;
 	uint32_t first_result;
-	struct string_ref_vec results;
+	/*
+	 * The results on screen, which point at whichever list is current:
+	 * the command list, the latest filtered commands, or the current nav
+	 * level's labels. Switching between them never copies anything.
+	 * commands is always fully ranked, so it can be shown as is. The
+	 * filter thread reads it, so it's only modified between
+	 * filter_worker_wait() and filter_worker_source_changed().
+	 */
+	struct string_ref_vec *results;
+	struct string_ref_vec filtered;
 	struct string_ref_vec commands;
+	struct filter_worker filter;
 	bool use_pango;
 
+	/*
+	 * Whether the results were filtered by the input, and so have matches
+	 * to highlight. If so, the input is compiled for highlighting the
+	 * results being drawn (see entry_result_spans()), with scratch space for
+	 * their spans.
+	 */
+	bool highlight_matches;
+	struct compiled_query highlight_query;
+	struct match_spans highlight_spans;
+
 	uint32_t clip_x;
 	uint32_t clip_y;
 	uint32_t clip_width;
@@ -103,4 +124,14 @@ void entry_init(struct entry *entry, uint8_t *restrict buffer, uint32_t width, u
 void entry_destroy(struct entry *entry);
 void entry_update(struct entry *entry);
 
+/*
+ * Find the characters of a result that match the input, for highlighting, and
+ * return how many runs of them there are. The runs are valid until the next
+ * call. Only call this while drawing.
+ */
+size_t entry_result_spans(
+		struct entry *entry,
+		const struct scored_string_ref *result,
+		const struct match_span **spans);
+
 #endif /* ENTRY_H */
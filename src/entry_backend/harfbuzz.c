@@ -133,21 +133,31 @@ static cairo_text_extents_t render_hb_buffer(cairo_t *cr, hb_font_extents_t *fon
 }
 
 /*
- * Clear the harfbuzz buffer, shape some text and render it with Cairo,
- * returning the extents of the rendered text in Cairo units.
+ * Clear the harfbuzz buffer, shape the first length bytes of some text (or
+ * all of it, if length is -1) and render it with Cairo, returning the extents
+ * of the rendered text in Cairo units.
  */
-static cairo_text_extents_t render_text(
+static cairo_text_extents_t render_text_n(
 		cairo_t *cr,
 		struct entry_backend_harfbuzz *hb,
-		const char *text)
+		const char *text,
+		int length)
 {
 	hb_buffer_clear_contents(hb->hb_buffer);
 	setup_hb_buffer(hb->hb_buffer);
-	hb_buffer_add_utf8(hb->hb_buffer, text, -1, 0, -1);
+	hb_buffer_add_utf8(hb->hb_buffer, text, length, 0, length);
 	hb_shape(hb->hb_font, hb->hb_buffer, hb->hb_features, hb->num_features);
 	return render_hb_buffer(cr, &hb->hb_font_extents, hb->hb_buffer, hb->scale);
 }
 
+static cairo_text_extents_t render_text(
+		cairo_t *cr,
+		struct entry_backend_harfbuzz *hb,
+		const char *text)
+{
+	return render_text_n(cr, hb, text, -1);
+}
+
 /*
  * Render the background box for a piece of text with the given theme and text
  * extents.
@@ -248,6 +258,138 @@ static cairo_text_extents_t render_text_themed(
 	return extents;
 }
 
+/*
+ * Render some text in the given colour, except for the characters covered by
+ * spans (sorted and non-overlapping, as reported by the matcher), which are
+ * drawn in the highlight colour.
+ *
+ * Each run of characters is shaped and drawn separately, one after the other,
+ * so we combine their extents to get those of the whole string.
+ */
+static cairo_text_extents_t render_text_spans(
+		cairo_t *cr,
+		struct entry_backend_harfbuzz *hb,
+		const char *text,
+		const struct match_span *spans,
+		size_t num_spans,
+		struct color color,
+		struct color highlight_color)
+{
+	cairo_save(cr);
+	cairo_text_extents_t extents = { 0 };
+	bool first = true;
+	const char *pos = text;
+	uint32_t index = 0;
+	size_t span = 0;
+	while (*pos != '\0') {
+		bool highlighted = span < num_spans && index >= spans[span].start;
+		uint32_t end = UINT32_MAX;
+		if (highlighted) {
+			end = spans[span].start + spans[span].length;
+			span++;
+		} else if (span < num_spans) {
+			end = spans[span].start;
+		}
+
+		const char *run = pos;
+		while (*pos != '\0' && index < end) {
+			pos = utf8_next_char(pos);
+			index++;
+		}
+		if (pos == run) {
+			continue;
+		}
+
+		struct color c = highlighted ? highlight_color : color;
+		cairo_set_source_rgba(cr, c.r, c.g, c.b, c.a);
+		cairo_text_extents_t subextents = render_text_n(cr, hb, run, pos - run);
+		if (first) {
+			extents = subextents;
+			first = false;
+		} else {
+			/*
+			 * This calculation is a little complex, but it's
+			 * basically:
+			 *
+			 * (distance from leftmost pixel of the text so far to
+			 * its logical end)
+			 *
+			 * +
+			 *
+			 * (distance from logical start of this run to its
+			 * rightmost pixel).
+			 */
+			extents.width = extents.x_advance
+				- extents.x_bearing
+				+ subextents.x_bearing
+				+ subextents.width;
+			extents.x_advance += subextents.x_advance;
+		}
+		cairo_translate(cr, subextents.x_advance, 0);
+	}
+	cairo_restore(cr);
+	return extents;
+}
+
+/*
+ * Render a result, highlighting the characters that matched the current
+ * filter if a highlight colour is set. The selected result is drawn in the
+ * accent colour, and others with the default result theme.
+ */
+static cairo_text_extents_t render_result(
+		cairo_t *cr,
+		struct entry *entry,
+		size_t index,
+		bool selected)
+{
+	const struct scored_string_ref *result = &entry->results->buf[index];
+	const struct text_theme *theme = &entry->default_result_theme;
+	const struct match_span *spans;
+	size_t num_spans = entry_result_spans(entry, result, &spans);
+
+	if (num_spans == 0) {
+		if (selected) {
+			struct color color = entry->accent_color;
+			cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
+			return render_text(cr, &entry->harfbuzz, result->string);
+		}
+		return render_text_themed(cr, entry, result->string, theme);
+	}
+
+	/*
+	 * We only want one background box around all the runs of text (if
+	 * we're drawing one), so follow the same method as
+	 * render_text_themed():
+	 * - Draw the text and measure it
+	 * - Draw the box
+	 * - Draw the text again
+	 */
+	struct color color = selected ? entry->accent_color : theme->foreground_color;
+	cairo_text_extents_t extents = render_text_spans(
+			cr,
+			&entry->harfbuzz,
+			result->string,
+			spans,
+			num_spans,
+			color,
+			entry->selection_highlight_color);
+
+	if (selected || theme->background_color.a == 0) {
+		return extents;
+	}
+
+	render_text_background(cr, entry, extents, theme);
+	render_text_spans(
+			cr,
+			&entry->harfbuzz,
+			result->string,
+			spans,
+			num_spans,
+			color,
+			entry->selection_highlight_color);
+	return extents;
+}
+
 /*
  * Rendering the input is more complicated when a cursor is involved.
  *
@@ -545,9 +687,9 @@ void entry_backend_harfbuzz_update(struct entry *entry)
 
 	uint32_t num_results;
 	if (entry->num_results == 0) {
-		num_results = entry->results.count;
+		num_results = entry->results->count;
 	} else {
-		num_results = MIN(entry->num_results, entry->results.count);
+		num_results = MIN(entry->num_results, entry->results->count);
 	}
 
 	/* Draw separator line between input and results */
@@ -581,170 +723,49 @@ void entry_backend_harfbuzz_update(struct entry *entry)
 		 * We may be on the last page, which could have fewer results
 		 * than expected, so check and break if necessary.
 		 */
-		if (index >= entry->results.count) {
+		if (index >= entry->results->count) {
 			break;
 		}
 
-		const char *result = entry->results.buf[index].string;
-		/*
-		 * If this isn't the selected result, or it is but we're not
-		 * doing any fancy match-highlighting, just print as normal.
-		 */
-		if (i != entry->selection || (entry->selection_highlight_color.a == 0)) {
-			if (i == entry->selection) {
-				struct color color = entry->accent_color;
-				cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-				extents = render_text(cr, &entry->harfbuzz, result);
-			} else {
-				extents = render_text_themed(cr, entry, result, &entry->default_result_theme);
-			}
+		string_ref_vec_rank(entry->results, index + 1);
+		extents = render_result(cr, entry, index, i == entry->selection);
 
-			if (entry->num_results > 0) {
-				/*
-				 * We're not auto-detecting how many results we
-				 * can fit, so just render the text.
-				 */
-				/* already rendered above */
-			} else if (!entry->horizontal) {
-				/*
-				 * The height of the text doesn't change, so
-				 * we don't need to re-measure it each time.
-				 */
-				if (size_overflows(entry, 0, entry->harfbuzz.line_spacing / 64.0)) {
-					break;
-				}
-			} else {
-				/*
-				 * The difficult case: we're auto-detecting how
-				 * many results to draw, but we can't know
-				 * whether this result will fit without
-				 * drawing it! To solve this, draw to a
-				 * temporary group, measure that, then copy it
-				 * to the main canvas only if it will fit.
-				 */
-				cairo_push_group(cr);
-				if (i == entry->selection) {
-					struct color color = entry->accent_color;
-					cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-					extents = render_text(cr, &entry->harfbuzz, result);
-				} else {
-					extents = render_text_themed(cr, entry, result, &entry->default_result_theme);
-				}
-
-				cairo_pattern_t *group = cairo_pop_group(cr);
-				if (size_overflows(entry, extents.x_advance, 0)) {
-					cairo_pattern_destroy(group);
-					break;
-				} else {
-					cairo_save(cr);
-					cairo_set_source(cr, group);
-					cairo_paint(cr);
-					cairo_restore(cr);
-					cairo_pattern_destroy(group);
-				}
+		if (entry->num_results > 0) {
+			/*
+			 * We're not auto-detecting how many results we
+			 * can fit, so just render the text.
+			 */
+			/* already rendered above */
+		} else if (!entry->horizontal) {
+			/*
+			 * The height of the text doesn't change, so
+			 * we don't need to re-measure it each time.
+			 */
+			if (size_overflows(entry, 0, entry->harfbuzz.line_spacing / 64.0)) {
+				break;
 			}
 		} else {
 			/*
-			 * For match highlighting, there's a bit more to do.
-			 *
-			 * We need to split the text into prematch, match and
-			 * postmatch chunks, and draw each separately.
-			 *
-			 * However, we only want one background box around them
-			 * all (if we're drawing one). To do this, we have to
-			 * do the rendering part of render_text_themed()
-			 * manually, with the same method of:
-			 * - Draw the text and measure it
-			 * - Draw the box
-			 * - Draw the text again
-			 *
-			 * N.B. The size_overflows check isn't necessary here,
-			 * as it's currently not possible for the selection to
-			 * do so.
+			 * The difficult case: we're auto-detecting how
+			 * many results to draw, but we can't know
+			 * whether this result will fit without
+			 * drawing it! To solve this, draw to a
+			 * temporary group, measure that, then copy it
+			 * to the main canvas only if it will fit.
 			 */
-			size_t prematch_len;
-			size_t postmatch_len;
-			char *prematch = xstrdup(result);
-			char *match = NULL;
-			char *postmatch = NULL;
-			if (entry->input_utf8_length > 0 && entry->selection_highlight_color.a != 0) {
-				char *match_pos = utf8_strcasestr(prematch, entry->input_utf8);
-				if (match_pos != NULL) {
-					match = xstrdup(result);
-					prematch_len = (match_pos - prematch);
-					prematch[prematch_len] = '\0';
-					postmatch_len = strlen(result) - prematch_len - entry->input_utf8_length;
-					if (postmatch_len > 0) {
-						postmatch = xstrdup(result);
-					}
-					match[entry->input_utf8_length + prematch_len] = '\0';
-				}
-			}
+			cairo_push_group(cr);
+			extents = render_result(cr, entry, index, i == entry->selection);
 
-			for (int pass = 0; pass < 2; pass++) {
+			cairo_pattern_t *group = cairo_pop_group(cr);
+			if (size_overflows(entry, extents.x_advance, 0)) {
+				cairo_pattern_destroy(group);
+				break;
+			} else {
 				cairo_save(cr);
-				struct color color = entry->accent_color;
-				cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-
-				cairo_text_extents_t subextents = render_text(cr, &entry->harfbuzz, prematch);
-				extents = subextents;
-
-				if (match != NULL) {
-					cairo_translate(cr, subextents.x_advance, 0);
-					color = entry->selection_highlight_color;
-					cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-
-					subextents = render_text(cr, &entry->harfbuzz, &match[prematch_len]);
-
-					if (prematch_len == 0) {
-						extents = subextents;
-					} else {
-						/*
-						 * This calculation is a little
-						 * complex, but it's basically:
-						 *
-						 * (distance from leftmost pixel of
-						 * prematch to logical end of prematch)
-						 * 
-						 * +
-						 *
-						 * (distance from logical start of match
-						 * to rightmost pixel of match).
-						 */
-						extents.width = extents.x_advance
-							- extents.x_bearing
-							+ subextents.x_bearing
-							+ subextents.width;
-						extents.x_advance += subextents.x_advance;
-					}
-				}
-
-				if (postmatch != NULL) {
-					cairo_translate(cr, subextents.x_advance, 0);
-					color = entry->accent_color;
-					cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-					subextents = render_text(
-							cr,
-							&entry->harfbuzz,
-							&postmatch[entry->input_utf8_length + prematch_len]);
-
-					extents.width = extents.x_advance
-						- extents.x_bearing
-						+ subextents.x_bearing
-						+ subextents.width;
-					extents.x_advance += subextents.x_advance;
-				}
-
+				cairo_set_source(cr, group);
+				cairo_paint(cr);
 				cairo_restore(cr);
-				break;
-			}
-
-			free(prematch);
-			if (match != NULL) {
-				free(match);
-			}
-			if (postmatch != NULL) {
-				free(postmatch);
+				cairo_pattern_destroy(group);
 			}
 		}
 		/* Translate down for next result */
@@ -101,6 +101,95 @@ static void render_text_themed(
 	pango_cairo_show_layout(cr, layout);
 }
 
+/*
+ * Build a list of attributes colouring the characters of text covered by
+ * spans (sorted and non-overlapping, as reported by the matcher). Pango
+ * attributes are indexed by byte, so convert as we walk the string.
+ */
+static PangoAttrList *highlight_attributes(
+		const char *text,
+		const struct match_span *spans,
+		size_t num_spans,
+		struct color color)
+{
+	PangoAttrList *attrs = pango_attr_list_new();
+	const char *pos = text;
+	uint32_t index = 0;
+	for (size_t i = 0; i < num_spans; i++) {
+		while (*pos != '\0' && index < spans[i].start) {
+			pos = utf8_next_char(pos);
+			index++;
+		}
+		const char *start = pos;
+		while (*pos != '\0' && index < spans[i].start + spans[i].length) {
+			pos = utf8_next_char(pos);
+			index++;
+		}
+		if (pos == start) {
+			break;
+		}
+
+		PangoAttribute *attr = pango_attr_foreground_new(
+				color.r * UINT16_MAX,
+				color.g * UINT16_MAX,
+				color.b * UINT16_MAX);
+		attr->start_index = start - text;
+		attr->end_index = pos - text;
+		pango_attr_list_insert(attrs, attr);
+
+		attr = pango_attr_foreground_alpha_new(color.a * UINT16_MAX);
+		attr->start_index = start - text;
+		attr->end_index = pos - text;
+		pango_attr_list_insert(attrs, attr);
+	}
+	return attrs;
+}
+
+/*
+ * Render a result, highlighting the characters that matched the current
+ * filter if a highlight colour is set. The selected result is drawn in the
+ * accent colour, and others with the default result theme.
+ */
+static void render_result(
+		cairo_t *cr,
+		struct entry *entry,
+		size_t index,
+		bool selected,
+		PangoRectangle *ink_rect,
+		PangoRectangle *logical_rect)
+{
+	PangoLayout *layout = entry->pango.layout;
+	const struct scored_string_ref *result = &entry->results->buf[index];
+
+	PangoAttrList *attrs = NULL;
+	const struct match_span *spans;
+	size_t num_spans = entry_result_spans(entry, result, &spans);
+	if (num_spans > 0) {
+		attrs = highlight_attributes(
+				result->string,
+				spans,
+				num_spans,
+				entry->selection_highlight_color);
+	}
+	pango_layout_set_attributes(layout, attrs);
+
+	if (selected) {
+		struct color color = entry->accent_color;
+		cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
+		pango_layout_set_text(layout, result->string, -1);
+		pango_cairo_update_layout(cr, layout);
+		pango_cairo_show_layout(cr, layout);
+		pango_layout_get_pixel_extents(layout, ink_rect, logical_rect);
+	} else {
+		render_text_themed(cr, entry, result->string, &entry->default_result_theme, ink_rect, logical_rect);
+	}
+
+	if (attrs != NULL) {
+		pango_layout_set_attributes(layout, NULL);
+		pango_attr_list_unref(attrs);
+	}
+}
+
 static void render_input(
 		cairo_t *cr,
 		PangoLayout *layout,
@@ -283,9 +372,9 @@ void entry_backend_pango_update(struct entry *entry)
 
 	uint32_t num_results;
 	if (entry->num_results == 0) {
-		num_results = entry->results.count;
+		num_results = entry->results->count;
 	} else {
-		num_results = MIN(entry->num_results, entry->results.count);
+		num_results = MIN(entry->num_results, entry->results->count);
 	}
 
 	/* Draw separator line between input and results */
@@ -320,127 +409,34 @@ void entry_backend_pango_update(struct entry *entry)
 		 * We may be on the last page, which could have fewer results
 		 * than expected, so check and break if necessary.
 		 */
-		if (index >= entry->results.count) {
+		if (index >= entry->results->count) {
 			break;
 		}
 
-		const char *str;
-		if (i < entry->results.count) {
-			str = entry->results.buf[index].string;
-		} else {
-			str = "";
-		}
-		if (i != entry->selection || (entry->selection_highlight_color.a == 0)) {
-			if (i == entry->selection) {
-				struct color sel_color = entry->accent_color;
-				cairo_set_source_rgba(cr, sel_color.r, sel_color.g, sel_color.b, sel_color.a);
-				pango_layout_set_text(entry->pango.layout, str, -1);
-				pango_cairo_update_layout(cr, entry->pango.layout);
-				pango_cairo_show_layout(cr, entry->pango.layout);
-				pango_layout_get_pixel_extents(entry->pango.layout, &ink_rect, &logical_rect);
-			} else {
-				render_text_themed(cr, entry, str, &entry->default_result_theme, &ink_rect, &logical_rect);
-			}
+		string_ref_vec_rank(entry->results, index + 1);
+		render_result(cr, entry, index, i == entry->selection, &ink_rect, &logical_rect);
 
-			if (entry->num_results > 0) {
-			} else if (!entry->horizontal) {
-				if (size_overflows(entry, 0, logical_rect.height)) {
-					entry->num_results_drawn = i;
-					break;
-				}
-			} else {
-				cairo_push_group(cr);
-				if (i == entry->selection) {
-					struct color sel_color = entry->accent_color;
-					cairo_set_source_rgba(cr, sel_color.r, sel_color.g, sel_color.b, sel_color.a);
-					pango_layout_set_text(entry->pango.layout, str, -1);
-					pango_cairo_update_layout(cr, entry->pango.layout);
-					pango_cairo_show_layout(cr, entry->pango.layout);
-					pango_layout_get_pixel_extents(entry->pango.layout, &ink_rect, &logical_rect);
-				} else {
-					render_text_themed(cr, entry, str, &entry->default_result_theme, &ink_rect, &logical_rect);
-				}
-
-				cairo_pattern_t *group = cairo_pop_group(cr);
-				if (size_overflows(entry, logical_rect.width, 0)) {
-					entry->num_results_drawn = i;
-					cairo_pattern_destroy(group);
-					break;
-				} else {
-					cairo_save(cr);
-					cairo_set_source(cr, group);
-					cairo_paint(cr);
-					cairo_restore(cr);
-					cairo_pattern_destroy(group);
-				}
+		if (entry->num_results > 0) {
+		} else if (!entry->horizontal) {
+			if (size_overflows(entry, 0, logical_rect.height)) {
+				entry->num_results_drawn = i;
+				break;
 			}
 		} else {
-			ssize_t prematch_len = -1;
-			ssize_t postmatch_len = -1;
-			size_t match_len = entry->input_utf8_length;
-			PangoRectangle ink_subrect;
-			PangoRectangle logical_subrect;
-			if (entry->input_utf8_length > 0 && entry->selection_highlight_color.a != 0) {
-				char *match_pos = utf8_strcasestr(str, entry->input_utf8);
-				if (match_pos != NULL) {
-					prematch_len = (match_pos - str);
-					postmatch_len = strlen(str) - prematch_len - match_len;
-					if (postmatch_len <= 0) {
-						postmatch_len = -1;
-					}
-				}
-			}
+			cairo_push_group(cr);
+			render_result(cr, entry, index, i == entry->selection, &ink_rect, &logical_rect);
 
-			for (int pass = 0; pass < 2; pass++) {
+			cairo_pattern_t *group = cairo_pop_group(cr);
+			if (size_overflows(entry, logical_rect.width, 0)) {
+				entry->num_results_drawn = i;
+				cairo_pattern_destroy(group);
+				break;
+			} else {
 				cairo_save(cr);
-				color = entry->accent_color;
-				cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-
-				pango_layout_set_text(layout, str, prematch_len);
-				pango_cairo_update_layout(cr, layout);
-				pango_cairo_show_layout(cr, layout);
-				pango_layout_get_pixel_extents(entry->pango.layout, &ink_subrect, &logical_subrect);
-				ink_rect = ink_subrect;
-				logical_rect = logical_subrect;
-
-				if (prematch_len != -1) {
-					cairo_translate(cr, logical_subrect.x + logical_subrect.width, 0);
-					color = entry->selection_highlight_color;
-					cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-					pango_layout_set_text(layout, &str[prematch_len], match_len);
-					pango_cairo_update_layout(cr, layout);
-					pango_cairo_show_layout(cr, layout);
-					pango_layout_get_pixel_extents(entry->pango.layout, &ink_subrect, &logical_subrect);
-					if (prematch_len == 0) {
-						ink_rect = ink_subrect;
-						logical_rect = logical_subrect;
-					} else {
-						ink_rect.width = logical_rect.width
-							- ink_rect.x
-							+ ink_subrect.x
-							+ ink_subrect.width;
-						logical_rect.width += logical_subrect.x + logical_subrect.width;
-					}
-				}
-
-				if (postmatch_len != -1) {
-					cairo_translate(cr, logical_subrect.x + logical_subrect.width, 0);
-					color = entry->accent_color;
-					cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-					pango_layout_set_text(layout, &str[prematch_len + match_len], -1);
-					pango_cairo_update_layout(cr, layout);
-					pango_cairo_show_layout(cr, layout);
-					pango_layout_get_pixel_extents(entry->pango.layout, &ink_subrect, &logical_subrect);
-					ink_rect.width = logical_rect.width
-						- ink_rect.x
-						+ ink_subrect.x
-						+ ink_subrect.width;
-					logical_rect.width += logical_subrect.x + logical_subrect.width;
-
-				}
-
+				cairo_set_source(cr, group);
+				cairo_paint(cr);
 				cairo_restore(cr);
-				break;
+				cairo_pattern_destroy(group);
 			}
 		}
 		/* Translate down for next result */
@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "filter.h"
+#include "log.h"
+#include "string_vec.h"
+#include "xmalloc.h"
+
+static void pop_step(struct filter_session *session);
+static bool is_prefix(const char *restrict prefix, const char *restrict str);
+static int worker_thread(void *arg);
+
+struct filter_session filter_session_create(
+		const struct string_ref_vec *source,
+		enum matching_algorithm algorithm)
+{
+	struct filter_session session = {
+		.source = source,
+		.algorithm = algorithm,
+		.count = 0,
+		.size = 16,
+		.steps = xcalloc(16, sizeof(*session.steps)),
+	};
+	return session;
+}
+
+void filter_session_destroy(struct filter_session *session)
+{
+	filter_session_reset(session);
+	candidate_store_destroy(&session->store);
+	free(session->steps);
+	session->steps = NULL;
+	session->size = 0;
+}
+
+void filter_session_reset(struct filter_session *session)
+{
+	while (session->count > 0) {
+		pop_step(session);
+	}
+}
+
+void filter_session_source_changed(struct filter_session *session)
+{
+	filter_session_reset(session);
+	candidate_store_destroy(&session->store);
+	session->packed = false;
+}
+
+const struct string_ref_vec *filter_session_update(
+		struct filter_session *session,
+		const char *query)
+{
+	if (query[0] == '\0') {
+		filter_session_reset(session);
+		return session->source;
+	}
+
+	/*
+	 * Throw away any cached steps that aren't for a prefix of the new
+	 * query, as their results may be missing some of our matches.
+	 */
+	while (session->count > 0
+			&& !is_prefix(session->steps[session->count - 1].query, query)) {
+		pop_step(session);
+	}
+
+	const struct string_ref_vec *candidates = session->source;
+	if (session->count > 0) {
+		struct filter_step *top = &session->steps[session->count - 1];
+		if (!strcmp(top->query, query)) {
+			log_debug("Reusing %zu cached results for \"%s\".\n",
+					top->results.count, query);
+			return &top->results;
+		}
+		candidates = &top->results;
+	}
+
+	if (session->count == session->size) {
+		session->size *= 2;
+		session->steps = xrealloc(
+				session->steps,
+				session->size * sizeof(session->steps[0]));
+	}
+	if (candidates == session->source && !session->packed) {
+		/* Only try this once, falling back to filtering in place. */
+		session->packed = true;
+		if (!candidate_store_init(&session->store, session->source)) {
+			log_error("Too many candidates to pack, filtering them in place.\n");
+		}
+	}
+
+	struct string_ref_vec results;
+	if (candidates == session->source && session->store.count > 0) {
+		results = candidate_store_filter(
+				&session->store,
+				query,
+				session->algorithm,
+				session->cancel);
+	} else {
+		results = string_ref_vec_filter(
+				candidates,
+				query,
+				session->algorithm,
+				session->cancel);
+	}
+	if (session->cancel != NULL && atomic_load(session->cancel)) {
+		string_ref_vec_destroy(&results);
+		return NULL;
+	}
+
+	struct filter_step *step = &session->steps[session->count];
+	step->query = xstrdup(query);
+	step->results = results;
+	session->count++;
+
+	return &step->results;
+}
+
+void pop_step(struct filter_session *session)
+{
+	struct filter_step *step = &session->steps[session->count - 1];
+	free(step->query);
+	string_ref_vec_destroy(&step->results);
+	session->count--;
+}
+
+bool is_prefix(const char *restrict prefix, const char *restrict str)
+{
+	return !strncmp(prefix, str, strlen(prefix));
+}
+
+void filter_worker_init(
+		struct filter_worker *worker,
+		const struct string_ref_vec *source,
+		enum matching_algorithm algorithm)
+{
+	*worker = (struct filter_worker){
+		.session = filter_session_create(source, algorithm),
+		.results = string_ref_vec_create(),
+	};
+	worker->session.cancel = &worker->cancel;
+	atomic_init(&worker->cancel, false);
+
+	worker->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (worker->fd == -1) {
+		log_error("Failed to create filter eventfd: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	mtx_init(&worker->lock, mtx_plain);
+	cnd_init(&worker->cond);
+	if (thrd_create(&worker->thread, worker_thread, worker) != thrd_success) {
+		log_error("Failed to start filter thread.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void filter_worker_destroy(struct filter_worker *worker)
+{
+	mtx_lock(&worker->lock);
+	worker->quit = true;
+	atomic_store(&worker->cancel, true);
+	cnd_broadcast(&worker->cond);
+	mtx_unlock(&worker->lock);
+	thrd_join(worker->thread, NULL);
+
+	cnd_destroy(&worker->cond);
+	mtx_destroy(&worker->lock);
+	close(worker->fd);
+	free(worker->pending);
+	free(worker->query);
+	string_ref_vec_destroy(&worker->results);
+	filter_session_destroy(&worker->session);
+}
+
+void filter_worker_request(struct filter_worker *worker, const char *query)
+{
+	mtx_lock(&worker->lock);
+	free(worker->pending);
+	worker->pending = xstrdup(query);
+	worker->generation++;
+	if (worker->busy) {
+		atomic_store(&worker->cancel, true);
+	}
+	cnd_broadcast(&worker->cond);
+	mtx_unlock(&worker->lock);
+}
+
+void filter_worker_wait(struct filter_worker *worker)
+{
+	mtx_lock(&worker->lock);
+	while (worker->pending != NULL || worker->busy) {
+		cnd_wait(&worker->cond, &worker->lock);
+	}
+	mtx_unlock(&worker->lock);
+}
+
+bool filter_worker_idle(struct filter_worker *worker)
+{
+	mtx_lock(&worker->lock);
+	bool idle = worker->pending == NULL && !worker->busy;
+	mtx_unlock(&worker->lock);
+	return idle;
+}
+
+void filter_worker_source_changed(struct filter_worker *worker)
+{
+	mtx_lock(&worker->lock);
+	filter_session_source_changed(&worker->session);
+	worker->ready = false;
+	mtx_unlock(&worker->lock);
+}
+
+bool filter_worker_collect(
+		struct filter_worker *worker,
+		const char *query,
+		struct string_ref_vec *results)
+{
+	/*
+	 * Clear the wakeup first, so that a pass finishing while we're here
+	 * wakes us up again rather than being missed.
+	 */
+	uint64_t value;
+	if (read(worker->fd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+		log_error("Failed to read filter eventfd: %s\n", strerror(errno));
+	}
+
+	mtx_lock(&worker->lock);
+	if (!worker->ready) {
+		mtx_unlock(&worker->lock);
+		return false;
+	}
+	worker->ready = false;
+	char *finished = worker->query;
+	struct string_ref_vec filtered = worker->results;
+	worker->query = NULL;
+	worker->results = string_ref_vec_create();
+	mtx_unlock(&worker->lock);
+
+	bool current = !strcmp(finished, query);
+	free(finished);
+	if (!current) {
+		string_ref_vec_destroy(&filtered);
+		return false;
+	}
+	string_ref_vec_destroy(results);
+	*results = filtered;
+	return true;
+}
+
+int worker_thread(void *arg)
+{
+	struct filter_worker *worker = arg;
+
+	mtx_lock(&worker->lock);
+	while (true) {
+		while (!worker->quit && worker->pending == NULL) {
+			cnd_wait(&worker->cond, &worker->lock);
+		}
+		if (worker->quit) {
+			break;
+		}
+		char *query = worker->pending;
+		uint64_t generation = worker->generation;
+		worker->pending = NULL;
+		worker->busy = true;
+		atomic_store(&worker->cancel, false);
+		mtx_unlock(&worker->lock);
+
+		log_debug("Filtering \"%s\" in the background.\n", query);
+		const struct string_ref_vec *filtered = filter_session_update(&worker->session, query);
+		struct string_ref_vec results = { 0 };
+		if (filtered != NULL) {
+			results = string_ref_vec_copy(filtered);
+		}
+
+		mtx_lock(&worker->lock);
+		worker->busy = false;
+		if (filtered != NULL && generation == worker->generation) {
+			free(worker->query);
+			string_ref_vec_destroy(&worker->results);
+			worker->query = query;
+			worker->results = results;
+			worker->ready = true;
+
+			uint64_t value = 1;
+			if (write(worker->fd, &value, sizeof(value)) == -1) {
+				log_error("Failed to write filter eventfd: %s\n", strerror(errno));
+			}
+		} else {
+			log_debug("Abandoned filtering \"%s\".\n", query);
+			free(query);
+			string_ref_vec_destroy(&results);
+		}
+		cnd_broadcast(&worker->cond);
+	}
+	mtx_unlock(&worker->lock);
+	return 0;
+}
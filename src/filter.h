@@ -0,0 +1,131 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+#include "matching.h"
+#include "string_vec.h"
+
+/*
+ * A filter session remembers the results of filtering a source list for each
+ * prefix of the current query. When the query grows, we only need to re-score
+ * the survivors of the previous step, and when it shrinks (e.g. Backspace),
+ * we can just pop back to a cached result set.
+ *
+ * This relies on any candidate matching a query also matching every prefix
+ * of that query, which holds for all of our matching algorithms.
+ *
+ * The first step filters the whole source list, so it goes through a packed
+ * copy of it (see struct candidate_store), built the first time it's needed.
+ * The source list mustn't change behind the session's back: after changing
+ * it, call filter_session_source_changed().
+ */
+struct filter_step {
+	char *query;
+	struct string_ref_vec results;
+};
+
+struct filter_session {
+	const struct string_ref_vec *source;
+	struct candidate_store store;
+	/* Whether we've tried to build store yet. */
+	bool packed;
+	enum matching_algorithm algorithm;
+	size_t count;
+	size_t size;
+	struct filter_step *steps;
+	/* If set by another thread, abandon the filter in progress. */
+	const atomic_bool *cancel;
+};
+
+[[nodiscard("memory leaked")]]
+struct filter_session filter_session_create(
+		const struct string_ref_vec *source,
+		enum matching_algorithm algorithm);
+
+void filter_session_destroy(struct filter_session *session);
+
+/* Drop all cached results, keeping the packed source list. */
+void filter_session_reset(struct filter_session *session);
+
+/* Drop everything derived from the source list, as it's been changed. */
+void filter_session_source_changed(struct filter_session *session);
+
+/*
+ * Return the results of filtering the source list with query. The returned
+ * vector is owned by the session, and is valid until the next call. If the
+ * filter is cancelled part-way through, nothing is cached and NULL is
+ * returned.
+ */
+const struct string_ref_vec *filter_session_update(
+		struct filter_session *session,
+		const char *query);
+
+/*
+ * A filter worker runs a filter session on a background thread, so that
+ * typing never has to wait for a pass over a large list.
+ *
+ * Each request bumps a generation counter, and a pass still running for an
+ * older generation is abandoned part-way through. Once the latest request
+ * has been filtered, fd becomes readable, and filter_worker_collect() hands
+ * over the results.
+ *
+ * The worker is the only user of the session (and the thread pool) while it
+ * runs, so its source list may only be changed between filter_worker_wait()
+ * and filter_worker_source_changed().
+ */
+struct filter_worker {
+	struct filter_session session;
+	int fd;
+	thrd_t thread;
+	mtx_t lock;
+	cnd_t cond;
+	bool quit;
+	bool busy;
+	atomic_bool cancel;
+
+	/* The latest request, not yet picked up by the thread. */
+	char *pending;
+	uint64_t generation;
+
+	/* The results of the latest finished pass, if not yet collected. */
+	bool ready;
+	char *query;
+	struct string_ref_vec results;
+};
+
+void filter_worker_init(
+		struct filter_worker *worker,
+		const struct string_ref_vec *source,
+		enum matching_algorithm algorithm);
+
+void filter_worker_destroy(struct filter_worker *worker);
+
+void filter_worker_request(struct filter_worker *worker, const char *query);
+
+/* Block until the latest request has been filtered. */
+void filter_worker_wait(struct filter_worker *worker);
+
+/* Whether the worker has nothing to filter, so isn't reading its source. */
+bool filter_worker_idle(struct filter_worker *worker);
+
+/*
+ * Tell an idle worker that its source list has changed. Any results not yet
+ * collected were filtered from the old list, so they're dropped, and the
+ * caller should make a new request.
+ */
+void filter_worker_source_changed(struct filter_worker *worker);
+
+/*
+ * If the results of a finished pass for query are waiting, replace *results
+ * with them and return true. Results for any other query are discarded.
+ */
+bool filter_worker_collect(
+		struct filter_worker *worker,
+		const char *query,
+		struct string_ref_vec *results);
+
+#endif /* FILTER_H */
@@ -3,6 +3,7 @@
 #include <linux/input-event-codes.h>
 #include <string.h>
 #include <unistd.h>
+#include "filter.h"
 #include "input.h"
 #include "log.h"
 #include "nav.h"
@@ -27,6 +28,7 @@ static void previous_cursor_or_result(struct tofi *tofi);
 static void reset_selection(struct tofi *tofi);
 static void nav_filter_results(struct tofi *tofi, const char *filter);
 static void nav_pop_and_restore(struct tofi *tofi);
+static void filter_commands(struct entry *entry);
 
 void input_scroll_up(struct tofi *tofi)
 {
@@ -61,24 +63,45 @@ static void nav_filter_results(struct tofi *tofi, const char *filter)
 		return;
 	}
 	
-	nav_results_destroy(&level->results);
-	string_ref_vec_destroy(&entry->results);
-	entry->results = string_ref_vec_create();
-	wl_list_init(&level->results);
+	string_ref_vec_destroy(&level->labels);
+	level->labels = string_ref_vec_create();
 	
-	struct nav_result *res;
-	wl_list_for_each(res, &level->backup_results, link) {
-		if (!filter || !filter[0] || match_words(MATCHING_ALGORITHM_FUZZY, filter, res->label) > 0) {
-			struct nav_result *copy = nav_result_create();
-			strncpy(copy->label, res->label, NAV_LABEL_MAX - 1);
-			strncpy(copy->value, res->value, NAV_VALUE_MAX - 1);
-			copy->action = res->action;
-			if (res->action.on_select) {
-				copy->action.on_select = action_def_copy(res->action.on_select);
-			}
-			wl_list_insert(&level->results, &copy->link);
-			string_ref_vec_add(&entry->results, copy->label);
-		}
+	nav_results_filter(&level->view, &level->results, filter, &level->labels);
+	entry->results = &level->labels;
+}
+
+/*
+ * Filter the top-level command list with the current input. This happens on
+ * a background thread, and the results are picked up from the main loop by
+ * input_collect_results(). The filter session caches results per query
+ * prefix, so typing only re-scores the previous matches, and deleting
+ * characters is usually free.
+ */
+static void filter_commands(struct entry *entry)
+{
+	filter_worker_request(&entry->filter, entry->input_utf8);
+}
+
+void input_collect_results(struct tofi *tofi, bool wait)
+{
+	struct entry *entry = &tofi->window.entry;
+
+	if (wait) {
+		filter_worker_wait(&entry->filter);
+	}
+
+	if (tofi->nav_current != NULL) {
+		/* We've moved on from the command list, so these are stale. */
+		struct string_ref_vec stale = string_ref_vec_create();
+		filter_worker_collect(&entry->filter, "", &stale);
+		string_ref_vec_destroy(&stale);
+		return;
+	}
+
+	if (filter_worker_collect(&entry->filter, entry->input_utf8, &entry->filtered)) {
+		entry->results = &entry->filtered;
+		reset_selection(tofi);
+		tofi->window.surface.redraw = true;
 	}
 }
 
@@ -103,19 +126,13 @@ static void nav_pop_and_restore(struct tofi *tofi)
 	if (wl_list_empty(&tofi->nav_stack)) {
 		tofi->nav_current = NULL;
 		snprintf(entry->prompt_text, MAX_PROMPT_LENGTH, "%s", tofi->base_prompt);
-		string_ref_vec_destroy(&entry->results);
-		entry->results = string_ref_vec_copy(&entry->commands);
+		entry->results = &entry->commands;
 		entry->selection = 0;
 		entry->first_result = 0;
 	} else {
 		tofi->nav_current = wl_container_of(tofi->nav_stack.next, tofi->nav_current, link);
 		
-		string_ref_vec_destroy(&entry->results);
-		entry->results = string_ref_vec_create();
-		struct nav_result *res;
-		wl_list_for_each(res, &tofi->nav_current->results, link) {
-			string_ref_vec_add(&entry->results, res->label);
-		}
+		entry->results = &tofi->nav_current->labels;
 		
 		entry->selection = tofi->nav_current->selection;
 		entry->first_result = tofi->nav_current->first_result;
@@ -281,13 +298,7 @@ void add_character(struct tofi *tofi, xkb_keycode_t keycode)
 				break;
 			}
 		} else {
-			string_ref_vec_destroy(&entry->results);
-			if (entry->input_utf8[0] == '\0') {
-				entry->results = string_ref_vec_copy(&entry->commands);
-			} else {
-				entry->results = string_ref_vec_filter(&entry->commands, entry->input_utf8, MATCHING_ALGORITHM_FUZZY);
-			}
-			reset_selection(tofi);
+			filter_commands(entry);
 		}
 	} else {
 		for (size_t i = entry->input_utf32_length; i > entry->cursor_position; i--) {
@@ -333,15 +344,7 @@ void input_refresh_results(struct tofi *tofi)
 		}
 	}
 
-	string_ref_vec_destroy(&entry->results);
-
-	if (entry->input_utf8[0] == '\0') {
-		entry->results = string_ref_vec_copy(&entry->commands);
-	} else {
-		entry->results = string_ref_vec_filter(&entry->commands, entry->input_utf8, MATCHING_ALGORITHM_FUZZY);
-	}
-
-	reset_selection(tofi);
+	filter_commands(entry);
 }
 
 void delete_character(struct tofi *tofi)
@@ -444,7 +447,7 @@ void select_previous_result(struct tofi *tofi)
 		return;
 	}
 
-	uint32_t nsel = MAX(MIN(entry->num_results_drawn, entry->results.count), 1);
+	uint32_t nsel = MAX(MIN(entry->num_results_drawn, entry->results->count), 1);
 
 	if (entry->first_result > nsel) {
 		entry->first_result -= entry->last_num_results_drawn;
@@ -452,11 +455,11 @@ void select_previous_result(struct tofi *tofi)
 	} else if (entry->first_result > 0) {
 		entry->selection = entry->first_result - 1;
 		entry->first_result = 0;
-	} else if (entry->results.count > 0) {
+	} else if (entry->results->count > 0) {
 		uint32_t page_size = entry->num_results_drawn;
-		uint32_t remaining = entry->results.count % page_size;
+		uint32_t remaining = entry->results->count % page_size;
 		uint32_t last_page_size = (remaining > 0) ? remaining : page_size;
-		entry->first_result = entry->results.count - last_page_size;
+		entry->first_result = entry->results->count - last_page_size;
 		entry->selection = last_page_size - 1;
 		entry->last_num_results_drawn = page_size;
 	}
@@ -471,14 +474,14 @@ void select_next_result(struct tofi *tofi)
 {
 	struct entry *entry = &tofi->window.entry;
 
-	uint32_t nsel = MAX(MIN(entry->num_results_drawn, entry->results.count), 1);
+	uint32_t nsel = MAX(MIN(entry->num_results_drawn, entry->results->count), 1);
 
 	entry->selection++;
 	if (entry->selection >= nsel) {
 		entry->selection -= nsel;
-		if (entry->results.count > 0) {
+		if (entry->results->count > 0) {
 			entry->first_result += nsel;
-			entry->first_result %= entry->results.count;
+			entry->first_result %= entry->results->count;
 		} else {
 			entry->first_result = 0;
 		}
@@ -524,7 +527,7 @@ void select_next_page(struct tofi *tofi)
 	struct entry *entry = &tofi->window.entry;
 
 	entry->first_result += entry->num_results_drawn;
-	if (entry->first_result >= entry->results.count) {
+	if (entry->first_result >= entry->results->count) {
 		entry->first_result = 0;
 	}
 	entry->selection = 0;
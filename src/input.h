@@ -9,5 +9,6 @@ void input_scroll_up(struct tofi *tofi);
 void input_scroll_down(struct tofi *tofi);
 void input_select_result(struct tofi *tofi, uint32_t index);
 void input_refresh_results(struct tofi *tofi);
+void input_collect_results(struct tofi *tofi, bool wait);
 
 #endif /* INPUT_H */
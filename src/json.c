@@ -225,8 +225,23 @@ bool json_skip_value(json_parser_t *p)
 	json_skip_ws(p);
 	
 	if (*p->pos == '"') {
-		char tmp[256];
-		return json_parse_string(p, tmp, sizeof(tmp));
+		/*
+		 * Don't decode the string, just find its end, so skipping long
+		 * strings doesn't fail.
+		 */
+		p->pos++;
+		while (*p->pos && *p->pos != '"') {
+			if (*p->pos == '\\' && p->pos[1]) {
+				p->pos++;
+			}
+			p->pos++;
+		}
+		if (*p->pos != '"') {
+			set_error(p, "unterminated string");
+			return false;
+		}
+		p->pos++;
+		return true;
 	}
 	if (*p->pos == '{') {
 		if (!json_object_begin(p)) return false;
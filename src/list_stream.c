@@ -0,0 +1,260 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json.h"
+#include "list_stream.h"
+#include "log.h"
+#include "xmalloc.h"
+
+static bool extract_json_field(json_parser_t *p, const char *field_name, char *out, size_t max_len)
+{
+	json_parser_t saved = *p;
+	char key[256];
+	bool has_more;
+
+	while (json_object_next(p, key, sizeof(key), &has_more) && has_more) {
+		if (strcmp(key, field_name) == 0) {
+			bool result = json_parse_string(p, out, max_len);
+			return result;
+		} else {
+			json_skip_value(p);
+		}
+		if (json_peek_char(p, ',')) {
+			json_expect_char(p, ',');
+		}
+	}
+
+	*p = saved;
+	return false;
+}
+
+static void add_result(const struct list_parser *parser, struct wl_list *results,
+	const char *label, size_t label_len, const char *value, size_t value_len)
+{
+	struct nav_result *res = nav_result_create(parser->arena);
+	res->label = arena_strndup(parser->arena, label, label_len);
+	res->value = value == label ? res->label : arena_strndup(parser->arena, value, value_len);
+	res->action = parser->action;
+	wl_list_insert(results->prev, &res->link);
+}
+
+/* Add a result for the line from start to end, unless it's blank. */
+static void parse_line(const struct list_parser *parser, const char *start, const char *end,
+	struct wl_list *results)
+{
+	while (start < end && isspace((unsigned char)*start)) start++;
+	while (end > start && isspace((unsigned char)end[-1])) end--;
+	if (start < end) {
+		add_result(parser, results, start, end - start, start, end - start);
+	}
+}
+
+/*
+ * Parse each line of text, returning a pointer past the last one parsed.
+ * Unless final, a line without a newline yet is left for later.
+ */
+static const char *parse_lines(const struct list_parser *parser, const char *text, bool final,
+	struct wl_list *results)
+{
+	const char *line = text;
+	const char *newline;
+	while ((newline = strchr(line, '\n')) != NULL) {
+		parse_line(parser, line, newline, results);
+		line = newline + 1;
+	}
+	if (final) {
+		const char *end = line + strlen(line);
+		parse_line(parser, line, end, results);
+		return end;
+	}
+	return line;
+}
+
+/*
+ * Parse the JSON object at p into a result, and move past it. Returns false
+ * if there isn't a complete object there.
+ *
+ * A decoded JSON string is never longer than its source, so buffers the size
+ * of the text being parsed can't truncate a field. json_parse_string() also
+ * wants a few bytes of slack for multi-byte escapes.
+ */
+static bool parse_json_object(const struct list_parser *parser, json_parser_t *p,
+	char *label, char *value, size_t max_len, struct wl_list *results)
+{
+	json_parser_t object = *p;
+	if (!json_peek_char(p, '{') || !json_skip_value(p)) {
+		return false;
+	}
+	json_object_begin(&object);
+
+	label[0] = '\0';
+	value[0] = '\0';
+	json_parser_t field = object;
+	extract_json_field(&field, parser->label_field, label, max_len);
+	field = object;
+	extract_json_field(&field, parser->value_field, value, max_len);
+
+	if (label[0]) {
+		size_t label_len = strlen(label);
+		if (value[0]) {
+			add_result(parser, results, label, label_len, value, strlen(value));
+		} else {
+			add_result(parser, results, label, label_len, label, label_len);
+		}
+	}
+	return true;
+}
+
+/*
+ * Parse a sequence of objects, returning a pointer past the last complete
+ * one. Parsing stops at anything that isn't an object, so that an object
+ * still being written can be picked up again once it's finished.
+ */
+static const char *parse_json_objects(const struct list_parser *parser, const char *text,
+	struct wl_list *results)
+{
+	size_t max_len = strlen(text) + 5;
+	char *label = xmalloc(max_len);
+	char *value = xmalloc(max_len);
+
+	json_parser_t p;
+	json_parser_init(&p, text);
+	const char *done;
+	while (true) {
+		json_skip_ws(&p);
+		done = p.pos;
+		if (!*p.pos || !parse_json_object(parser, &p, label, value, max_len, results)) {
+			break;
+		}
+	}
+
+	free(label);
+	free(value);
+	return done;
+}
+
+static void parse_json_array(const struct list_parser *parser, const char *text,
+	struct wl_list *results)
+{
+	json_parser_t p;
+	json_parser_init(&p, text);
+	if (!json_array_begin(&p)) {
+		return;
+	}
+
+	size_t max_len = strlen(text) + 5;
+	char *label = xmalloc(max_len);
+	char *value = xmalloc(max_len);
+
+	bool has_more;
+	while (json_array_next(&p, &has_more) && has_more) {
+		if (!parse_json_object(parser, &p, label, value, max_len, results)) {
+			break;
+		}
+		if (json_peek_char(&p, ',')) {
+			json_expect_char(&p, ',');
+		}
+	}
+
+	free(label);
+	free(value);
+}
+
+void list_parse(const struct list_parser *parser, const char *output, struct wl_list *results)
+{
+	if (parser->format == FORMAT_LINES) {
+		parse_lines(parser, output, true, results);
+	} else if (parser->format == FORMAT_JSON) {
+		while (isspace((unsigned char)*output)) output++;
+		if (*output == '[') {
+			parse_json_array(parser, output, results);
+		} else {
+			parse_json_objects(parser, output, results);
+		}
+	}
+}
+
+struct list_stream *list_stream_create(const char *cmd, const struct list_parser *parser, bool keep_output)
+{
+	struct list_stream *stream = xcalloc(1, sizeof(*stream));
+	if (!subprocess_start(&stream->proc, cmd)) {
+		free(stream);
+		return NULL;
+	}
+	stream->parser = *parser;
+	stream->keep_output = keep_output;
+	return stream;
+}
+
+bool list_stream_read(struct list_stream *stream, struct wl_list *results)
+{
+	struct subprocess *proc = &stream->proc;
+	bool finished = subprocess_read(proc);
+	char *text = &proc->buffer[stream->parsed];
+
+	if (stream->parser.format == FORMAT_JSON && !stream->sniffed) {
+		const char *start = text;
+		while (isspace((unsigned char)*start)) start++;
+		if (*start) {
+			stream->sniffed = true;
+			stream->array = *start == '[';
+		}
+	}
+
+	if (stream->array || (stream->parser.format == FORMAT_JSON && !stream->sniffed)) {
+		/* Nothing we can parse until we have the whole thing. */
+		if (finished) {
+			list_parse(&stream->parser, text, results);
+		}
+	} else {
+		/* Stop at the end of the last full line, unless there's no more to come. */
+		char *end = &proc->buffer[proc->length];
+		if (!finished) {
+			while (end > text && end[-1] != '\n') end--;
+		}
+		char saved = *end;
+		*end = '\0';
+		const char *done;
+		if (stream->parser.format == FORMAT_LINES) {
+			done = parse_lines(&stream->parser, text, finished, results);
+		} else {
+			done = parse_json_objects(&stream->parser, text, results);
+		}
+		*end = saved;
+		stream->parsed = done - proc->buffer;
+
+		if (!stream->keep_output) {
+			subprocess_consume(proc, stream->parsed);
+			stream->parsed = 0;
+		}
+	}
+
+	if (!finished) {
+		return false;
+	}
+
+	/* Like popen(), we take whatever output there is regardless of exit status. */
+	if (!subprocess_finish(proc)) {
+		log_debug("List command exited unsuccessfully.\n");
+	}
+	if (stream->keep_output) {
+		stream->output = proc->buffer;
+	} else {
+		free(proc->buffer);
+	}
+	proc->buffer = NULL;
+	return true;
+}
+
+void list_stream_destroy(struct list_stream *stream)
+{
+	if (stream == NULL) {
+		return;
+	}
+	if (stream->proc.fd != -1) {
+		subprocess_kill(&stream->proc);
+	}
+	free(stream->proc.buffer);
+	free(stream->output);
+	free(stream);
+}
@@ -0,0 +1,69 @@
+#ifndef LIST_STREAM_H
+#define LIST_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <wayland-client.h>
+#include "arena.h"
+#include "nav.h"
+#include "subprocess.h"
+
+/*
+ * How to turn a list command's output into results.
+ *
+ * FORMAT_LINES gives a result for each non-blank line. FORMAT_JSON takes
+ * either an array of objects, or a sequence of objects (usually one per line,
+ * i.e. NDJSON), reading label_field and value_field from each.
+ *
+ * Results are appended in output order. They're allocated from arena, and
+ * borrow action, so the arena mustn't outlive it.
+ */
+struct list_parser {
+	format_t format;
+	const char *label_field;
+	const char *value_field;
+	struct action_def *action;
+	struct arena *arena;
+};
+
+/* Parse a command's whole output at once. */
+void list_parse(const struct list_parser *parser, const char *output, struct wl_list *results);
+
+/*
+ * A running list command whose output is parsed as it arrives, so that the
+ * first results can be shown while the rest are still coming. Lines and
+ * records of a sequence of objects are parsed as soon as they're complete,
+ * while a JSON array has to wait for the whole output.
+ *
+ * The parser's strings must outlive the stream.
+ */
+struct list_stream {
+	struct list_parser parser;
+	struct subprocess proc;
+	/* How much of proc.buffer has been parsed already. */
+	size_t parsed;
+	/* Whether output is a JSON array, once we've seen its first byte. */
+	bool sniffed;
+	bool array;
+	/*
+	 * Keep the whole output (e.g. to cache it), rather than throwing away
+	 * what's been parsed.
+	 */
+	bool keep_output;
+	char *output;
+};
+
+[[nodiscard("memory leaked")]]
+struct list_stream *list_stream_create(const char *cmd, const struct list_parser *parser, bool keep_output);
+
+/*
+ * Read whatever output is available, appending the results of each complete
+ * record. Returns true once the command has finished, after which output
+ * holds its whole output if keep_output was set.
+ */
+bool list_stream_read(struct list_stream *stream, struct wl_list *results);
+
+/* Kill the command if it's still running, and free the stream. */
+void list_stream_destroy(struct list_stream *stream);
+
+#endif /* LIST_STREAM_H */
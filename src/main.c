@@ -20,14 +20,18 @@
 #include "builtin.h"
 #include "config.h"
 #include "entry.h"
+#include "filter.h"
 #include "input.h"
 #include "log.h"
+#include "matching.h"
 #include "plugin.h"
+#include "provider_cache.h"
 #include "nelem.h"
 #include "lock.h"
 #include "scale.h"
 #include "shm.h"
 #include "string_vec.h"
+#include "threadpool.h"
 #include "unicode.h"
 #include "viewporter.h"
 #include "xmalloc.h"
@@ -849,7 +853,11 @@ static void usage(bool err)
 "      --text-color            Text color.\n"
 "      --border-width <px>     Border width.\n"
 "      --accent-color          Accent color (border, selection, separator).\n"
+"      --selection-match-color Color of matched characters in results.\n"
 "      --corner-radius <px>    Corner radius.\n"
+"      --parallel-filter-threshold <n>\n"
+"                              Filter lists of at least n results on all CPUs\n"
+"                              (0 to disable).\n"
 "\n"
 "Config file: ~/.config/hypr-tofi/config\n"
 "Plugins dir: ~/.config/hypr-tofi/plugins/\n"
@@ -870,6 +878,7 @@ const struct option long_options[] = {
 	{"border-width", required_argument, NULL, 0},
 	{"text-color", required_argument, NULL, 0},
 	{"accent-color", required_argument, NULL, 0},
+	{"selection-match-color", required_argument, NULL, 0},
 	{"width", required_argument, NULL, 0},
 	{"height", required_argument, NULL, 0},
 	{"margin-top", required_argument, NULL, 0},
@@ -877,6 +886,7 @@ const struct option long_options[] = {
 	{"margin-left", required_argument, NULL, 0},
 	{"margin-right", required_argument, NULL, 0},
 	{"padding", required_argument, NULL, 0},
+	{"parallel-filter-threshold", required_argument, NULL, 0},
 	{NULL, 0, NULL, 0}
 };
 const char *short_options = ":hc:p:";
@@ -940,17 +950,6 @@ static void parse_args(struct tofi *tofi, int argc, char *argv[])
 	}
 }
 
-static struct nav_result *find_nav_result(struct nav_level *level, const char *label)
-{
-	struct nav_result *res;
-	wl_list_for_each(res, &level->results, link) {
-		if (strcmp(res->label, label) == 0) {
-			return res;
-		}
-	}
-	return NULL;
-}
-
 static void nav_push_level(struct tofi *tofi, struct nav_level *level)
 {
 	wl_list_insert(&tofi->nav_stack, &level->link);
@@ -977,10 +976,13 @@ static void nav_pop_level(struct tofi *tofi)
 	
 	wl_list_remove(&current->link);
 	
+	/* Don't leave the entry showing the labels we're about to destroy. */
 	if (wl_list_empty(&tofi->nav_stack)) {
 		tofi->nav_current = NULL;
+		tofi->window.entry.results = &tofi->window.entry.commands;
 	} else {
 		tofi->nav_current = wl_container_of(tofi->nav_stack.next, tofi->nav_current, link);
+		tofi->window.entry.results = &tofi->nav_current->labels;
 	}
 	
 	nav_level_destroy(current);
@@ -990,13 +992,7 @@ static void update_entry_from_level(struct tofi *tofi, struct nav_level *level)
 {
 	struct entry *entry = &tofi->window.entry;
 	
-	string_ref_vec_destroy(&entry->results);
-	entry->results = string_ref_vec_create();
-	
-	struct nav_result *res;
-	wl_list_for_each(res, &level->results, link) {
-		string_ref_vec_add(&entry->results, res->label);
-	}
+	entry->results = &level->labels;
 	
 	entry->selection = level->selection;
 	entry->first_result = level->first_result;
@@ -1089,9 +1085,7 @@ static void feedback_history_load(struct nav_level *level)
 				json_object_end(&parser);
 				
 				if (has_is_user && has_content) {
-					struct feedback_entry *entry = feedback_entry_create();
-					entry->is_user = is_user;
-					strncpy(entry->content, content, NAV_VALUE_MAX - 1);
+					struct feedback_entry *entry = feedback_entry_create(is_user, content);
 					wl_list_insert(&level->results, &entry->link);
 				}
 				
@@ -1170,17 +1164,28 @@ void feedback_history_save(struct nav_level *level)
 	fclose(fp);
 }
 
-static void update_entry_from_feedback_level(struct tofi *tofi, struct nav_level *level)
+/*
+ * Rebuild the labels of a feedback level after its entries have changed. The
+ * labels point at the entries' contents, so changing those in place (as the
+ * loading animation does) needs no rebuild.
+ */
+static void feedback_level_labels(struct nav_level *level)
 {
-	struct entry *entry = &tofi->window.entry;
-	
-	string_ref_vec_destroy(&entry->results);
-	entry->results = string_ref_vec_create();
+	string_ref_vec_destroy(&level->labels);
+	level->labels = string_ref_vec_create();
 	
 	struct feedback_entry *fe;
 	wl_list_for_each(fe, &level->results, link) {
-		string_ref_vec_add(&entry->results, fe->content);
+		string_ref_vec_add(&level->labels, fe->content);
 	}
+}
+
+static void update_entry_from_feedback_level(struct tofi *tofi, struct nav_level *level)
+{
+	struct entry *entry = &tofi->window.entry;
+	
+	feedback_level_labels(level);
+	entry->results = &level->labels;
 	
 	entry->selection = 0;
 	entry->first_result = 0;
@@ -1246,23 +1251,21 @@ static void feedback_spawn_process(struct tofi *tofi, struct nav_level *level)
 	tofi->feedback_process.loading_frame = 0;
 	level->feedback_loading = true;
 	
-	if (level->show_input && level->display_input[0]) {
+	if (level->show_input && level->display_input) {
 		struct value_dict *input_dict = dict_copy(level->dict);
 		dict_set(&input_dict, "input", level->input_buffer);
 		char *formatted = template_resolve(level->display_input, input_dict);
 		dict_destroy(input_dict);
 		
 		if (formatted) {
-			struct feedback_entry *user_entry = feedback_entry_create();
-			user_entry->is_user = true;
-			strncpy(user_entry->content, formatted, NAV_VALUE_MAX - 1);
+			struct feedback_entry *user_entry = feedback_entry_create(true, formatted);
 			wl_list_insert(&level->results, &user_entry->link);
 			free(formatted);
 		}
 	}
 	
-	struct feedback_entry *loading_entry = feedback_entry_create();
-	loading_entry->is_user = false;
+	/* Sized for the longest animation frame, which is written in place. */
+	struct feedback_entry *loading_entry = feedback_entry_create(false, "...");
 	strcpy(loading_entry->content, ".");
 	wl_list_insert(&level->results, &loading_entry->link);
 	
@@ -1275,12 +1278,8 @@ static void feedback_spawn_process(struct tofi *tofi, struct nav_level *level)
 	entry->input_utf8[0] = '\0';
 	entry->cursor_position = 0;
 	
-	string_ref_vec_destroy(&entry->results);
-	entry->results = string_ref_vec_create();
-	struct feedback_entry *fe;
-	wl_list_for_each(fe, &level->results, link) {
-		string_ref_vec_add(&entry->results, fe->content);
-	}
+	feedback_level_labels(level);
+	entry->results = &level->labels;
 	tofi->window.surface.redraw = true;
 }
 
@@ -1337,7 +1336,7 @@ static void feedback_process_complete(struct tofi *tofi)
 		result[--total] = '\0';
 	}
 	
-	if (total > 0 && level->display_result[0]) {
+	if (total > 0 && level->display_result) {
 		struct value_dict *dict = dict_copy(level->dict);
 		dict_set(&dict, "input", level->input_buffer);
 		dict_set(&dict, "result", result);
@@ -1345,21 +1344,15 @@ static void feedback_process_complete(struct tofi *tofi)
 		dict_destroy(dict);
 		
 		if (formatted) {
-			struct feedback_entry *result_entry = feedback_entry_create();
-			result_entry->is_user = false;
-			strncpy(result_entry->content, formatted, NAV_VALUE_MAX - 1);
+			struct feedback_entry *result_entry = feedback_entry_create(false, formatted);
 			wl_list_insert(&level->results, &result_entry->link);
 			free(formatted);
 		}
 	} else if (total > 0) {
-		struct feedback_entry *result_entry = feedback_entry_create();
-		result_entry->is_user = false;
-		strncpy(result_entry->content, result, NAV_VALUE_MAX - 1);
+		struct feedback_entry *result_entry = feedback_entry_create(false, result);
 		wl_list_insert(&level->results, &result_entry->link);
 	} else {
-		struct feedback_entry *error_entry = feedback_entry_create();
-		error_entry->is_user = false;
-		strncpy(error_entry->content, "Error: no output", NAV_VALUE_MAX - 1);
+		struct feedback_entry *error_entry = feedback_entry_create(false, "Error: no output");
 		wl_list_insert(&level->results, &error_entry->link);
 	}
 	
@@ -1397,9 +1390,7 @@ static void feedback_process_check_timeout(struct tofi *tofi)
 				}
 			}
 			
-			struct feedback_entry *error_entry = feedback_entry_create();
-			error_entry->is_user = false;
-			strncpy(error_entry->content, "Error: timeout", NAV_VALUE_MAX - 1);
+			struct feedback_entry *error_entry = feedback_entry_create(false, "Error: timeout");
 			wl_list_insert(&level->results, &error_entry->link);
 			
 			update_entry_from_feedback_level(tofi, level);
@@ -1433,19 +1424,338 @@ static void feedback_update_loading_animation(struct tofi *tofi)
 	tofi->feedback_process.loading_frame = (tofi->feedback_process.loading_frame + 1) % 3;
 	const char *frames[] = {".", "..", "..."};
 	strcpy(first->content, frames[tofi->feedback_process.loading_frame]);
+	tofi->window.surface.redraw = true;
+}
+
+/*
+ * Add a top-level result to the command list, labelled with its plugin's
+ * prefix. The label is allocated alongside the result, in arena unless it's
+ * from a provider.
+ */
+static void add_command(struct string_ref_vec *commands, struct nav_result *pr, struct arena *arena)
+{
+	struct plugin *plugin = plugin_get(pr->source_plugin);
+	if (plugin && plugin_provided(plugin, pr)) {
+		arena = &plugin->provider_arena;
+	}
+	const char *prefix = plugin ? plugin->display_prefix : "";
+	if (prefix && *prefix) {
+		size_t prefix_len = strlen(prefix);
+		size_t label_len = strlen(pr->label);
+		char *display = arena_alloc(arena, prefix_len + label_len + 4);
+		memcpy(display, prefix, prefix_len);
+		memcpy(display + prefix_len, " > ", 3);
+		memcpy(display + prefix_len + 3, pr->label, label_len + 1);
+		pr->label = display;
+	}
+	char *key = utf8_fold(pr->label);
+	uint32_t *key_map = key ? match_key_map(pr->label, key) : NULL;
+	string_ref_vec_add_keyed(commands, pr->label, key, key_map, match_mask(pr->label, key));
+	commands->buf[commands->count - 1].data = pr;
+}
+
+/*
+ * Drop the results of a plugin's provider from the command list, keeping the
+ * rest (including the plugin's actions) in order. The results themselves are
+ * left for the caller to free, along with the arena they're in.
+ */
+static void remove_plugin_commands(struct tofi *tofi, const struct plugin *plugin)
+{
+	/* The filter thread mustn't be reading the list, see entry.results. */
+	assert(filter_worker_idle(&tofi->window.entry.filter));
+	
+	struct string_ref_vec *commands = &tofi->window.entry.commands;
+	size_t kept = 0;
+	for (size_t i = 0; i < commands->count; i++) {
+		struct nav_result *pr = commands->buf[i].data;
+		if (strcmp(pr->source_plugin, plugin->name) == 0 && plugin_provided(plugin, pr)) {
+			free(commands->buf[i].key);
+			free(commands->buf[i].key_map);
+			wl_list_remove(&pr->link);
+			continue;
+		}
+		commands->buf[kept] = commands->buf[i];
+		commands->buf[kept].index = kept;
+		kept++;
+	}
+	commands->count = kept;
+	commands->sorted = kept;
+}
+
+/*
+ * Select the result at index, keeping it on the same row (row) if there's
+ * room.
+ */
+static void select_result_at(struct tofi *tofi, size_t index, uint32_t row)
+{
+	struct entry *entry = &tofi->window.entry;
+	if (index >= row) {
+		entry->first_result = index - row;
+		entry->selection = row;
+	} else {
+		entry->first_result = 0;
+		entry->selection = index;
+	}
+	if (tofi->nav_current) {
+		tofi->nav_current->selection = entry->selection;
+		tofi->nav_current->first_result = entry->first_result;
+	}
+}
+
+/* The selected result, if there is one. */
+static const struct nav_result *selected_result(const struct entry *entry)
+{
+	size_t index = entry->first_result + entry->selection;
+	if (index >= entry->results->count) {
+		return NULL;
+	}
+	return entry->results->buf[index].data;
+}
+
+/*
+ * Find where pr is in results, or failing that (if it's been replaced) a
+ * result with the same label, or just the first result.
+ */
+static size_t find_result(const struct string_ref_vec *results, const struct nav_result *pr)
+{
+	if (pr == NULL) {
+		return 0;
+	}
+	for (size_t i = 0; i < results->count; i++) {
+		if (results->buf[i].data == pr) {
+			return i;
+		}
+	}
+	for (size_t i = 0; i < results->count; i++) {
+		if (strcmp(results->buf[i].string, pr->label) == 0) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+static size_t plugin_position(const char *name)
+{
+	struct plugin *plugin = plugin_get(name);
+	return plugin ? plugin->position : 0;
+}
+
+/*
+ * The command list is grouped by plugin, the last one loaded first (see
+ * plugin_populate_results()). Find where the results of the plugin at
+ * position belong, which is before those of the first plugin loaded ahead
+ * of it.
+ */
+static size_t plugin_commands_start(const struct string_ref_vec *commands, size_t position)
+{
+	const char *name = NULL;
+	size_t name_position = 0;
+	for (size_t i = 0; i < commands->count; i++) {
+		const struct nav_result *pr = commands->buf[i].data;
+		/* A plugin's results all share its name, so only look it up once. */
+		if (pr->source_plugin != name) {
+			name = pr->source_plugin;
+			name_position = plugin_position(name);
+		}
+		if (name_position < position) {
+			return i;
+		}
+	}
+	return commands->count;
+}
+
+/* Move the last n commands to start at index to, keeping the rest in order. */
+static void move_new_commands(struct string_ref_vec *commands, size_t n, size_t to)
+{
+	size_t from = commands->count - n;
+	if (n == 0 || from == to) {
+		return;
+	}
+	struct scored_string_ref *moved = xmalloc(n * sizeof(*moved));
+	memcpy(moved, &commands->buf[from], n * sizeof(*moved));
+	memmove(&commands->buf[to + n], &commands->buf[to], (from - to) * sizeof(*moved));
+	memcpy(&commands->buf[to], moved, n * sizeof(*moved));
+	free(moved);
+	for (size_t i = to; i < commands->count; i++) {
+		commands->buf[i].index = i;
+	}
+}
+
+/*
+ * Some global providers have produced results, so merge them into the
+ * command list (replacing the provider results of plugin replaced, if it
+ * isn't NULL), and re-filter it if it isn't being shown as is. Once this
+ * returns, nothing refers to the replaced results any more.
+ *
+ * Each plugin's results go in its own place in the list, so the order
+ * doesn't depend on which provider happens to finish first, and refreshed
+ * results take the place of the ones they replace.
+ */
+static void handle_provider_results(struct tofi *tofi, struct wl_list *results, const struct plugin *replaced)
+{
+	struct entry *entry = &tofi->window.entry;
+	
+	/* The filter thread mustn't be reading the list while it changes. */
+	filter_worker_wait(&entry->filter);
 	
+	/*
+	 * Keep the selection on the same command (or one with the same label,
+	 * if it's being replaced), wherever it moves to.
+	 */
+	const struct nav_result *selected = NULL;
+	uint32_t row = entry->selection;
+	if (tofi->nav_current == NULL) {
+		selected = selected_result(entry);
+	}
+	
+	if (replaced) {
+		remove_plugin_commands(tofi, replaced);
+	}
+	
+	/* Each provider's results are together, so add a plugin's at a time. */
+	const char *plugin = NULL;
+	size_t start = 0;
+	size_t added = 0;
+	struct nav_result *pr;
+	wl_list_for_each(pr, results, link) {
+		if (pr->source_plugin != plugin) {
+			move_new_commands(&entry->commands, added, start);
+			plugin = pr->source_plugin;
+			start = plugin_commands_start(&entry->commands, plugin_position(plugin));
+			added = 0;
+		}
+		add_command(&entry->commands, pr, &tofi->base_arena);
+		added++;
+	}
+	move_new_commands(&entry->commands, added, start);
+	wl_list_insert_list(&tofi->base_results, results);
+	filter_worker_source_changed(&entry->filter);
+	log_debug("Commands count: %zu\n", entry->commands.count);
+	
+	if (tofi->nav_current != NULL) {
+		/* The filtered list isn't being shown, but may refer to old results. */
+		string_ref_vec_destroy(&entry->filtered);
+		entry->filtered = string_ref_vec_create();
+	} else if (entry->results == &entry->commands) {
+		select_result_at(tofi, find_result(&entry->commands, selected), row);
+	} else {
+		/*
+		 * The filtered list refers to results (and keys) that may have
+		 * just been freed, so it can't be shown until it's filtered
+		 * again. This only happens when a provider finishes, so just
+		 * wait for it.
+		 */
+		filter_worker_request(&entry->filter, entry->input_utf8);
+		input_collect_results(tofi, true);
+		select_result_at(tofi, find_result(&entry->filtered, selected), row);
+	}
+	tofi->window.surface.redraw = true;
+}
+
+static struct provider_cache_key level_cache_key(const struct nav_level *level)
+{
+	return (struct provider_cache_key){
+		.cmd = level->list_cmd,
+		.format = level->format,
+		.label_field = level->label_field,
+		.value_field = level->value_field,
+		.tag = "",
+	};
+}
+
+/*
+ * If the current level is showing a list whose cached output has just been
+ * refreshed, reload it in place, keeping the filter and the selection.
+ */
+static void reload_level(struct tofi *tofi, const struct provider_cache_key *key)
+{
+	struct nav_level *level = tofi->nav_current;
+	if (!level || level->mode != SELECTION_SELECT) {
+		return;
+	}
+	
+	struct provider_cache_key level_key = level_cache_key(level);
+	if (!provider_cache_key_equal(key, &level_key)) {
+		return;
+	}
+	
+	log_debug("Reloading \"%s\" with refreshed output.\n", level->list_cmd);
 	struct entry *entry = &tofi->window.entry;
-	string_ref_vec_destroy(&entry->results);
-	entry->results = string_ref_vec_create();
-	struct feedback_entry *fe;
-	wl_list_for_each(fe, &level->results, link) {
-		string_ref_vec_add(&entry->results, fe->content);
+	const struct nav_result *selected = selected_result(entry);
+	uint32_t row = entry->selection;
+	list_stream_destroy(level->stream);
+	
+	/*
+	 * Parse into a fresh arena, so that refreshes don't pile up copies of
+	 * the list. The old results are only freed once nothing refers to them.
+	 */
+	struct arena retired = level->arena;
+	level->arena = (struct arena){0};
+	level->stream = plugin_run_list_cmd(level->list_cmd, level->format,
+		level->label_field, level->value_field,
+		level->on_select, &level->action->cache,
+		&level->results, &level->arena);
+	nav_level_show_all(level);
+	input_refresh_results(tofi);
+	select_result_at(tofi, find_result(&level->labels, selected), row);
+	arena_destroy(&retired);
+	tofi->window.surface.redraw = true;
+}
+
+/* A background refresh of some list command's output has changed it. */
+static void handle_provider_refresh(const struct provider_cache_key *key, void *data)
+{
+	struct tofi *tofi = data;
+	reload_level(tofi, key);
+	
+	struct wl_list results;
+	struct arena retired = {0};
+	struct plugin *plugin = plugin_provider_refreshed(key, &results, &retired);
+	if (plugin) {
+		log_debug("Replacing results of plugin \"%s\".\n", plugin->name);
+		handle_provider_results(tofi, &results, plugin);
+		arena_destroy(&retired);
 	}
+}
+
+/*
+ * The current level's list command has more output. Add whatever's been
+ * parsed to the level, filtered like the rest, but only redraw while the
+ * window has room for more rows, or once the command has finished.
+ */
+static void handle_list_output(struct tofi *tofi)
+{
+	struct entry *entry = &tofi->window.entry;
+	struct nav_level *level = tofi->nav_current;
+	
+	struct wl_list results;
+	wl_list_init(&results);
+	bool finished = list_stream_read(level->stream, &results);
+	if (level->labels.count <= entry->first_result + entry->num_results_drawn) {
+		tofi->window.surface.redraw = true;
+	}
+	nav_level_add_results(level, &results, entry->input_utf8);
+	if (!finished) {
+		return;
+	}
+	
+	log_debug("\"%s\" finished with %zu results.\n", level->list_cmd, level->labels.count);
+	if (level->stream->output) {
+		struct provider_cache_key key = level_cache_key(level);
+		provider_cache_store(&key, &level->action->cache, level->stream->output);
+	}
+	list_stream_destroy(level->stream);
+	level->stream = NULL;
 	tofi->window.surface.redraw = true;
 }
 
-static void execute_command(const char *template, struct value_dict *dict)
+static void execute_command(const struct template *template, struct value_dict *dict)
 {
+	if (!template) {
+		log_debug("Nothing to execute.\n");
+		return;
+	}
+	
 	char *cmd = template_resolve(template, dict);
 	if (!cmd) {
 		log_error("Failed to resolve template\n");
@@ -1513,29 +1823,15 @@ static bool do_submit(struct tofi *tofi)
 	
 	uint32_t selection = entry->selection + entry->first_result;
 
-	if (entry->results.count == 0) {
+	if (entry->results->count == 0) {
 		return false;
 	}
 
-	char *res = entry->results.buf[selection].string;
-
-	struct nav_result *nav_res = NULL;
-	if (level) {
-		nav_res = find_nav_result(level, res);
-	}
-	
-	if (!level && !wl_list_empty(&tofi->base_results)) {
-		struct nav_result *r;
-		wl_list_for_each(r, &tofi->base_results, link) {
-			if (strcmp(res, r->label) == 0) {
-				nav_res = r;
-				break;
-			}
-		}
-	}
+	string_ref_vec_rank(entry->results, selection + 1);
+	struct nav_result *nav_res = entry->results->buf[selection].data;
 	
 	if (nav_res) {
-		struct action_def *action = &nav_res->action;
+		struct action_def *action = nav_res->action;
 		struct value_dict *dict = level ? dict_copy(level->dict) : dict_create();
 		
 		if (action->as[0]) {
@@ -1545,7 +1841,7 @@ static bool do_submit(struct tofi *tofi)
 		switch (action->selection_type) {
 		case SELECTION_SELF:
 			if (action->execution_type == EXECUTION_EXEC) {
-				execute_command(action->template, dict);
+				execute_command(action->compiled.template, dict);
 				dict_destroy(dict);
 				return true;
 			} else {
@@ -1569,12 +1865,13 @@ static bool do_submit(struct tofi *tofi)
 			
 		case SELECTION_INPUT: {
 			struct nav_level *new_level = nav_level_create(SELECTION_INPUT, dict);
-			strncpy(new_level->template, action->template, NAV_TEMPLATE_MAX - 1);
+			new_level->action = action_def_ref(action);
+			new_level->template = action->compiled.template;
 			strncpy(new_level->prompt, action->prompt, NAV_PROMPT_MAX - 1);
 			strncpy(new_level->as, action->as, NAV_KEY_MAX - 1);
 			new_level->execution_type = action->execution_type;
 			
-			char *resolved_prompt = template_resolve(action->prompt, dict);
+			char *resolved_prompt = template_resolve(action->compiled.prompt, dict);
 			if (resolved_prompt) {
 				strncpy(new_level->display_prompt, resolved_prompt, NAV_PROMPT_MAX - 1);
 				free(resolved_prompt);
@@ -1595,7 +1892,8 @@ static bool do_submit(struct tofi *tofi)
 			
 		case SELECTION_SELECT: {
 			struct nav_level *new_level = nav_level_create(SELECTION_SELECT, dict);
-			strncpy(new_level->template, action->template, NAV_TEMPLATE_MAX - 1);
+			new_level->action = action_def_ref(action);
+			new_level->template = action->compiled.template;
 			strncpy(new_level->as, action->as, NAV_KEY_MAX - 1);
 			strncpy(new_level->list_cmd, action->list_cmd, NAV_CMD_MAX - 1);
 			new_level->format = action->format;
@@ -1603,19 +1901,28 @@ static bool do_submit(struct tofi *tofi)
 			strncpy(new_level->value_field, action->value_field, NAV_FIELD_MAX - 1);
 			new_level->execution_type = action->execution_type;
 			
+			/*
+			 * Every listed result shares one action, which the level
+			 * owns for as long as the results borrow it.
+			 */
 			if (action->on_select) {
-				new_level->on_select = action_def_copy(action->on_select);
+				new_level->on_select = action_def_ref(action->on_select);
+			} else {
+				new_level->on_select = action_def_create();
+				strncpy(new_level->on_select->template, action->template, NAV_TEMPLATE_MAX - 1);
+				strncpy(new_level->on_select->as, action->as, NAV_KEY_MAX - 1);
+				action_def_compile(new_level->on_select);
 			}
 			
-			plugin_run_list_cmd(action->list_cmd, action->format,
-				action->label_field, action->value_field,
-				action->on_select, action->template, action->as,
-				&new_level->results);
+			new_level->stream = plugin_run_list_cmd(new_level->list_cmd, new_level->format,
+				new_level->label_field, new_level->value_field,
+				new_level->on_select, &action->cache,
+				&new_level->results, &new_level->arena);
 			
-			nav_results_copy(&new_level->backup_results, &new_level->results);
+			nav_level_show_all(new_level);
 			
 			if (action->prompt[0]) {
-				char *resolved = template_resolve(action->prompt, dict);
+				char *resolved = template_resolve(action->compiled.prompt, dict);
 				if (resolved) {
 					strncpy(new_level->display_prompt, resolved, NAV_PROMPT_MAX - 1);
 					free(resolved);
@@ -1644,13 +1951,14 @@ static bool do_submit(struct tofi *tofi)
 			}
 			
 			struct nav_level *new_level = nav_level_create(SELECTION_PLUGIN, dict);
-			strncpy(new_level->template, action->template, NAV_TEMPLATE_MAX - 1);
+			new_level->action = action_def_ref(action);
+			new_level->template = action->compiled.template;
 			strncpy(new_level->as, action->as, NAV_KEY_MAX - 1);
 			strncpy(new_level->plugin_ref, action->plugin_ref, NAV_NAME_MAX - 1);
 			new_level->execution_type = action->execution_type;
 			
-			plugin_populate_plugin_actions(target_plugin, &new_level->results);
-			nav_results_copy(&new_level->backup_results, &new_level->results);
+			plugin_populate_plugin_actions(target_plugin, &new_level->results, &new_level->arena);
+			nav_level_show_all(new_level);
 			
 			if (target_plugin->context_name[0]) {
 				snprintf(new_level->display_prompt, NAV_PROMPT_MAX, "%s: ", target_plugin->context_name);
@@ -1671,9 +1979,10 @@ static bool do_submit(struct tofi *tofi)
 			
 		case SELECTION_FEEDBACK: {
 			struct nav_level *new_level = nav_level_create(SELECTION_FEEDBACK, dict);
-			strncpy(new_level->eval_cmd, action->eval_cmd, NAV_CMD_MAX - 1);
-			strncpy(new_level->display_input, action->display_input, NAV_TEMPLATE_MAX - 1);
-			strncpy(new_level->display_result, action->display_result, NAV_TEMPLATE_MAX - 1);
+			new_level->action = action_def_ref(action);
+			new_level->eval_cmd = action->compiled.eval_cmd;
+			new_level->display_input = action->compiled.display_input;
+			new_level->display_result = action->compiled.display_result;
 			new_level->show_input = action->show_input;
 			new_level->history_limit = action->history_limit;
 			new_level->persist_history = action->persist_history;
@@ -1687,7 +1996,7 @@ static bool do_submit(struct tofi *tofi)
 			}
 			
 			if (action->prompt[0]) {
-				char *resolved = template_resolve(action->prompt, dict);
+				char *resolved = template_resolve(action->compiled.prompt, dict);
 				if (resolved) {
 					strncpy(new_level->display_prompt, resolved, NAV_PROMPT_MAX - 1);
 					free(resolved);
@@ -1838,6 +2147,7 @@ int main(int argc, char *argv[])
 			| ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT
 			| ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT,
 		.use_scale = true,
+		.parallel_filter_threshold = 20000,
 	};
 	wl_list_init(&tofi.output_list);
 	wl_list_init(&tofi.nav_stack);
@@ -1858,6 +2168,8 @@ int main(int argc, char *argv[])
 	parse_args(&tofi, argc, argv);
 	log_debug("Config done.\n");
 
+	threadpool_init(tofi.parallel_filter_threshold);
+
 	/*
 	 * Initial Wayland & XKB setup.
 	 * The first thing to do is connect a listener to the global registry,
@@ -2093,32 +2405,26 @@ int main(int argc, char *argv[])
 	
 	struct string_ref_vec commands = string_ref_vec_create();
 	
-	plugin_populate_results(&tofi.base_results);
+	plugin_populate_results(&tofi.base_results, &tofi.base_arena);
 	int plugin_result_count = 0;
 	struct nav_result *pr;
 	wl_list_for_each(pr, &tofi.base_results, link) {
 		plugin_result_count++;
-		struct plugin *plugin = plugin_get(pr->source_plugin);
-		const char *prefix = plugin ? plugin->display_prefix : "";
-		char *display = xmalloc(512);
-		if (prefix && *prefix) {
-			snprintf(display, 512, "%s > %s", prefix, pr->label);
-		} else {
-			strncpy(display, pr->label, 511);
-			display[511] = '\0';
-		}
-		string_ref_vec_add(&commands, display);
-		
-		strncpy(pr->label, display, NAV_LABEL_MAX - 1);
+		add_command(&commands, pr, &tofi.base_arena);
 	}
 	
 	tofi.window.entry.commands = commands;
+	filter_worker_init(
+			&tofi.window.entry.filter,
+			&tofi.window.entry.commands,
+			MATCHING_ALGORITHM_FUZZY);
 	
 	log_debug("Loaded %d plugin results.\n", plugin_result_count);
 	log_debug("Commands count: %zu\n", tofi.window.entry.commands.count);
 	log_unindent();
 	log_debug("Plugin list generated.\n");
-	tofi.window.entry.results = string_ref_vec_copy(&tofi.window.entry.commands);
+	tofi.window.entry.filtered = string_ref_vec_create();
+	tofi.window.entry.results = &tofi.window.entry.commands;
 
 	/*
 	 * Next, we create the Wayland surface, which takes on the
@@ -2330,7 +2636,7 @@ int main(int argc, char *argv[])
 	 * order of the various functions called here.
 	 */
 	while (!tofi.closed) {
-		struct pollfd pollfds[3] = {{0}, {0}, {0}};
+		struct pollfd pollfds[5 + PROVIDER_CACHE_MAX_REFRESHES + PLUGIN_MAX_RUNNING_PROVIDERS] = {{0}};
 		pollfds[0].fd = wl_display_get_fd(tofi.wl_display);
 
 		/* Make sure we're ready to receive events on the main queue. */
@@ -2386,6 +2692,29 @@ int main(int argc, char *argv[])
 			pollfds[nfds].events = POLLIN | POLLHUP;
 			nfds++;
 		}
+
+		/* Wake up when background filtering has finished. */
+		int filter_idx = nfds;
+		pollfds[nfds].fd = tofi.window.entry.filter.fd;
+		pollfds[nfds].events = POLLIN;
+		nfds++;
+
+		/* And when the current level's list command has more output. */
+		int stream_idx = -1;
+		if (tofi.nav_current != NULL && tofi.nav_current->stream != NULL) {
+			stream_idx = nfds;
+			pollfds[nfds].fd = tofi.nav_current->stream->proc.fd;
+			pollfds[nfds].events = POLLIN;
+			nfds++;
+		}
+
+		/* And when list commands refreshing in the background produce output. */
+		int cache_idx = nfds;
+		nfds += provider_cache_pollfds(&pollfds[nfds], PROVIDER_CACHE_MAX_REFRESHES);
+
+		/* And when global providers still starting up produce output. */
+		int provider_idx = nfds;
+		nfds += plugin_provider_pollfds(&pollfds[nfds], PLUGIN_MAX_RUNNING_PROVIDERS);
 		
 		int res = poll(pollfds, nfds, timeout);
 		
@@ -2414,7 +2743,7 @@ int main(int argc, char *argv[])
 			} else {
 				/*
 				 * No events to read - we were woken up to
-				 * handle clipboard data.
+				 * handle clipboard data or filter results.
 				 */
 				wl_display_cancel_read(tofi.wl_display);
 			}
@@ -2438,18 +2767,44 @@ int main(int argc, char *argv[])
 					feedback_process_complete(&tofi);
 				}
 			}
+			if (pollfds[filter_idx].revents & POLLIN) {
+				input_collect_results(&tofi, false);
+			}
+			if (stream_idx >= 0 && (pollfds[stream_idx].revents & (POLLIN | POLLHUP | POLLERR))) {
+				handle_list_output(&tofi);
+			}
+			provider_cache_dispatch(
+					&pollfds[cache_idx],
+					provider_idx - cache_idx,
+					handle_provider_refresh,
+					&tofi);
+			struct wl_list provider_results;
+			wl_list_init(&provider_results);
+			if (plugin_provider_dispatch(
+						&pollfds[provider_idx],
+						nfds - provider_idx,
+						&provider_results)) {
+				handle_provider_results(&tofi, &provider_results, NULL);
+			}
 		}
 
 		/* Handle any events we read. */
 		wl_display_dispatch_pending(tofi.wl_display);
 
 		if (tofi.window.surface.redraw) {
+			/* Input and feedback levels don't filter their results. */
+			struct nav_level *level = tofi.nav_current;
+			tofi.window.entry.highlight_matches = level == NULL
+				|| level->mode == SELECTION_SELECT
+				|| level->mode == SELECTION_PLUGIN;
 			entry_update(&tofi.window.entry);
 			surface_draw(&tofi.window.surface);
 			tofi.window.surface.redraw = false;
 		}
 		if (tofi.submit) {
 			tofi.submit = false;
+			/* Make sure we submit from the results for the latest input. */
+			input_collect_results(&tofi, true);
 			if (do_submit(&tofi)) {
 				break;
 			}
@@ -2507,8 +2862,14 @@ int main(int argc, char *argv[])
 	xkb_keymap_unref(tofi.xkb_keymap);
 	xkb_context_unref(tofi.xkb_context);
 	wl_registry_destroy(tofi.wl_registry);
+	filter_worker_destroy(&tofi.window.entry.filter);
+	threadpool_destroy();
+	for (size_t i = 0; i < tofi.window.entry.commands.count; i++) {
+		free(tofi.window.entry.commands.buf[i].key);
+		free(tofi.window.entry.commands.buf[i].key_map);
+	}
 	string_ref_vec_destroy(&tofi.window.entry.commands);
-	string_ref_vec_destroy(&tofi.window.entry.results);
+	string_ref_vec_destroy(&tofi.window.entry.filtered);
 	
 	struct nav_level *lvl;
 	wl_list_for_each(lvl, &tofi.nav_stack, link) {
@@ -2519,7 +2880,8 @@ int main(int argc, char *argv[])
 	
 	plugin_destroy();
 	builtin_cleanup();
-	nav_results_destroy(&tofi.base_results);
+	provider_cache_destroy();
+	arena_destroy(&tofi.base_arena);
 	dict_destroy(tofi.base_dict);
 #endif
 	/*
@@ -2,6 +2,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "matching.h"
@@ -10,244 +11,442 @@
 
 #undef MAX
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#undef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 static int32_t simple_match_words(
-		const char *restrict patterns,
-		const char *restrict str);
+		const struct compiled_query *restrict query,
+		const char *restrict str,
+		const char *restrict key,
+		const uint32_t *restrict key_map,
+		struct match_spans *restrict spans);
 
 static int32_t prefix_match_words(
-		const char *restrict patterns,
-		const char *restrict str);
+		const struct compiled_query *restrict query,
+		const char *restrict str,
+		const char *restrict key,
+		const uint32_t *restrict key_map,
+		struct match_spans *restrict spans);
 
 static int32_t fuzzy_match_words(
-		const char *restrict patterns,
-		const char *restrict str);
+		const struct compiled_query *restrict query,
+		const char *restrict str,
+		const char *restrict key,
+		const uint32_t *restrict key_map,
+		struct match_spans *restrict spans);
 
 static int32_t fuzzy_match(
-		const char *restrict pattern,
-		const char *restrict str);
+		const struct query_word *restrict word,
+		size_t slen,
+		const uint32_t *restrict chars,
+		const int32_t *restrict bonuses,
+		int32_t *restrict scores,
+		struct match_spans *restrict spans);
+
+static void fuzzy_backtrack(
+		size_t plen,
+		size_t slen,
+		const int32_t *restrict bonuses,
+		const int32_t *restrict scores,
+		size_t end,
+		struct match_spans *restrict spans);
+
+static int32_t compute_bonus(
+		size_t index,
+		uint32_t cur,
+		uint32_t prev);
+
+static uint64_t char_bit(uint32_t c);
+
+static uint32_t key_offset_to_char(
+		const char *restrict str,
+		const uint32_t *restrict key_map,
+		size_t offset);
 
-static int32_t fuzzy_match_recurse(
-		const char *restrict pattern,
+static uint32_t key_end_to_char(
 		const char *restrict str,
-		int32_t score,
-		bool first_match_only,
-		bool first_char);
+		const uint32_t *restrict key_map,
+		size_t end);
 
-static int32_t compute_score(
-		int32_t jump,
-		bool first_char,
-		const char *restrict match);
+static void add_span(struct match_spans *spans, uint32_t start, uint32_t length);
+
+static void merge_spans(struct match_spans *spans, size_t first);
 
 /*
- * Select the appropriate algorithm, and return its score.
- * Each algorithm returns larger scores for better matches,
- * and returns INT32_MIN if a word is not found.
+ * Normalise patterns, split it into words, and decode each word, ready for
+ * matching against lots of candidates with the given algorithm.
  */
-int32_t match_words(
+struct compiled_query compiled_query_create(
 		enum matching_algorithm algorithm,
-		const char *restrict patterns,
-		const char *restrict str)
+		const char *restrict patterns)
 {
+	struct compiled_query query = {
+		.algorithm = algorithm,
+	};
+
 	switch (algorithm) {
 		case MATCHING_ALGORITHM_NORMAL:
-			return simple_match_words(patterns, str);
+			query.match = simple_match_words;
+			query.text = utf8_fold(patterns);
+			break;
 		case MATCHING_ALGORITHM_PREFIX:
-			return prefix_match_words(patterns, str);
+			query.match = prefix_match_words;
+			query.text = utf8_fold(patterns);
+			break;
 		case MATCHING_ALGORITHM_FUZZY:
-			return fuzzy_match_words(patterns, str);
 		default:
-			return INT32_MIN;
+			query.match = fuzzy_match_words;
+			query.text = utf8_normalize(patterns);
+			break;
+	}
+	if (query.text == NULL) {
+		query.text = xstrdup(patterns);
 	}
-}
 
-/*
- * Split patterns into words, and perform simple matching against str for each.
- * Returns the negative sum of substring distances from the start of str.
- * If a word is not found, returns INT32_MIN.
- */
-int32_t simple_match_words(const char *restrict patterns, const char *restrict str)
-{
-	int32_t score = 0;
+	/*
+	 * We split text in place, so there can't be more words or characters
+	 * than it has bytes.
+	 */
+	size_t len = strlen(query.text);
+	query.words = xcalloc(len / 2 + 1, sizeof(*query.words));
+	query.chars = xcalloc(len + 1, sizeof(*query.chars));
+
+	uint32_t *chars = query.chars;
 	char *saveptr = NULL;
-	char *tmp = utf8_normalize(patterns);
-	char *pattern = strtok_r(tmp, " ", &saveptr);
+	char *pattern = strtok_r(query.text, " ", &saveptr);
 	while (pattern != NULL) {
-		char *c = utf8_strcasestr(str, pattern);
-		if (c == NULL) {
-			score = INT32_MIN;
-			break;
-		} else {
-			score -= c - str;
+		struct query_word *word = &query.words[query.num_words];
+		word->text = pattern;
+		word->chars = chars;
+		for (const char *c = pattern; *c != '\0'; c = utf8_next_char(c)) {
+			uint32_t lower = utf32_tolower(utf8_to_utf32(c));
+			chars[word->length] = lower;
+			word->length++;
+			if (lower < 0x80) {
+				word->mask |= char_bit(lower);
+			}
 		}
+		chars += word->length;
+		query.mask |= word->mask;
+		query.num_words++;
 		pattern = strtok_r(NULL, " ", &saveptr);
 	}
-	free(tmp);
-	return score;
+
+	return query;
+}
+
+void compiled_query_destroy(struct compiled_query *query)
+{
+	free(query->words);
+	free(query->chars);
+	free(query->text);
 }
 
 /*
- * Split patterns into words, and perform prefix matching against str for each.
- * Returns the negative sum of remaining string suffix lengths.
- * If a word is not found, returns INT32_MIN.
+ * Return the character-presence mask of str, whose folded form is key.
+ *
+ * The fuzzy matcher compares lower-cased characters of str, while the others
+ * compare bytes of key, so we include both. If key is NULL, it's computed here.
  */
-int32_t prefix_match_words(const char *restrict patterns, const char *restrict str)
+uint64_t match_mask(const char *restrict str, const char *restrict key)
 {
-	int32_t score = 0;
-	char *saveptr = NULL;
-	char *tmp = utf8_normalize(patterns);
-	char *pattern = strtok_r(tmp, " ", &saveptr);
-	while (pattern != NULL) {
-		char *c = utf8_strcasestr(str, pattern);
-		if (c != str) {
-			score = INT32_MIN;
-			break;
-		} else {
-			score -= utf8_strlen(str) - utf8_strlen(pattern);
+	uint64_t mask = 0;
+	for (const char *c = str; *c != '\0'; c = utf8_next_char(c)) {
+		uint32_t lower = utf32_tolower(utf8_to_utf32(c));
+		if (lower < 0x80) {
+			mask |= char_bit(lower);
+		}
+	}
+
+	char *tmp = NULL;
+	if (key == NULL) {
+		tmp = utf8_fold(str);
+		key = tmp;
+	}
+	if (key != NULL) {
+		for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; c++) {
+			if (*c < 0x80) {
+				mask |= char_bit(*c);
+			}
 		}
-		pattern = strtok_r(NULL, " ", &saveptr);
 	}
 	free(tmp);
-	return score;
+	return mask;
 }
 
+/*
+ * Map a lower-case ASCII character to its bit in a character-presence mask.
+ * Letters and digits get a bit each, and everything else shares the rest.
+ */
+uint64_t char_bit(uint32_t c)
+{
+	if (c >= 'a' && c <= 'z') {
+		return 1ull << (c - 'a');
+	}
+	if (c >= '0' && c <= '9') {
+		return 1ull << (26 + c - '0');
+	}
+	return 1ull << (36 + c % 28);
+}
+
+void match_spans_destroy(struct match_spans *spans)
+{
+	free(spans->buf);
+	spans->buf = NULL;
+	spans->count = 0;
+	spans->size = 0;
+}
+
+void add_span(struct match_spans *spans, uint32_t start, uint32_t length)
+{
+	if (length == 0) {
+		return;
+	}
+	if (spans->count == spans->size) {
+		spans->size = spans->size ? 2 * spans->size : 64;
+		spans->buf = xrealloc(spans->buf, spans->size * sizeof(*spans->buf));
+	}
+	spans->buf[spans->count].start = start;
+	spans->buf[spans->count].length = length;
+	spans->count++;
+}
+
+static int cmpspanp(const void *restrict a, const void *restrict b)
+{
+	const struct match_span *restrict span_a = a;
+	const struct match_span *restrict span_b = b;
+	if (span_a->start < span_b->start) {
+		return -1;
+	}
+	return span_a->start > span_b->start;
+}
 
 /*
- * Split patterns into words, and return the sum of fuzzy_match(word, str).
- * If a word is not found, returns INT32_MIN.
+ * Sort the spans added since first, and join any that overlap or touch, as
+ * different words of a query can match the same characters.
  */
-int32_t fuzzy_match_words(const char *restrict patterns, const char *restrict str)
+void merge_spans(struct match_spans *spans, size_t first)
 {
-	int32_t score = 0;
-	char *saveptr = NULL;
-	char *tmp = utf8_normalize(patterns);
-	char *pattern = strtok_r(tmp, " ", &saveptr);
-	while (pattern != NULL) {
-		int32_t word_score = fuzzy_match(pattern, str);
-		if (word_score == INT32_MIN) {
-			score = INT32_MIN;
-			break;
+	size_t n = spans->count - first;
+	if (n < 2) {
+		return;
+	}
+	struct match_span *buf = &spans->buf[first];
+	qsort(buf, n, sizeof(*buf), cmpspanp);
+
+	size_t last = 0;
+	for (size_t i = 1; i < n; i++) {
+		uint32_t end = buf[last].start + buf[last].length;
+		if (buf[i].start <= end) {
+			end = MAX(end, buf[i].start + buf[i].length);
+			buf[last].length = end - buf[last].start;
 		} else {
-			score += word_score;
+			last++;
+			buf[last] = buf[i];
 		}
-		pattern = strtok_r(NULL, " ", &saveptr);
 	}
-	free(tmp);
-	return score;
+	spans->count = first + last + 1;
 }
 
 /*
- * Returns score if each character in pattern is found sequentially within str.
- * Returns INT32_MIN otherwise.
+ * The separator match_key_map() puts between characters. Neither
+ * normalisation nor case-folding touches control characters, and nothing
+ * combines with them.
  */
-int32_t fuzzy_match(const char *restrict pattern, const char *restrict str)
+#define KEY_MAP_SEPARATOR '\x1f'
+
+uint32_t *match_key_map(const char *restrict str, const char *restrict key)
 {
-	const int unmatched_letter_penalty = -1;
-	const size_t slen = utf8_strlen(str);
-	const size_t plen = utf8_strlen(pattern);
-	int32_t score = 0;
+	size_t len = strlen(str);
+	size_t key_len = strlen(key);
+	if (key == str || len == key_len || strchr(str, KEY_MAP_SEPARATOR) != NULL) {
+		return NULL;
+	}
 
-	if (*pattern == '\0') {
-		return score;
+	/*
+	 * Fold all of str in one go, but with a separator after each
+	 * character, so we can see how long each one's folded form is.
+	 */
+	char *separated = xmalloc(2 * len + 1);
+	char *pos = separated;
+	for (const char *c = str; *c != '\0'; ) {
+		const char *next = utf8_next_char(c);
+		memcpy(pos, c, next - c);
+		pos += next - c;
+		*pos++ = KEY_MAP_SEPARATOR;
+		c = next;
 	}
-	if (slen < plen) {
-		return INT32_MIN;
+	*pos = '\0';
+	char *folded = utf8_fold(separated);
+	free(separated);
+	if (folded == NULL) {
+		return NULL;
 	}
 
-	/* We can already penalise any unused letters. */
-	score += unmatched_letter_penalty * (int32_t)(slen - plen);
-
-        /*
-         * If the string is more than 100 characters, just find the first fuzzy
-         * match rather than the best.
-         *
-         * This is required as the number of possible matches (for patterns and
-         * strings all consisting of one letter) scales something like:
-         *
-         * slen! / (plen! (slen - plen)!)  ~  slen^plen for plen << slen
-         *
-         * This quickly grinds everything to a halt. 100 is chosen fairly
-         * arbitrarily from the following logic:
-         *
-         * - e is the most common character in English, at around 13% of
-         *   letters. Depending on the context, let's say this be up to 20%.
-         * - 100 * 0.20 = 20 repeats of the same character.
-         * - In the worst case here, 20! / (10! 10!) ~200,000 possible matches,
-         *   which is "slow but not frozen" for my machine.
-         *
-         * In reality, this worst case shouldn't be hit, and finding the "best"
-         * fuzzy match in lines of text > 100 characters isn't really in scope
-         * for a dmenu clone.
-         */
-        bool first_match_only = slen > 100;
-
-	/* Perform the match. */
-	score = fuzzy_match_recurse(pattern, str, score, first_match_only, true);
+	uint32_t *map = xmalloc((key_len + 1) * sizeof(*map));
+	size_t offset = 0;
+	uint32_t n = 0;
+	for (const char *c = folded; *c != '\0' && offset < key_len; c++) {
+		if (*c == KEY_MAP_SEPARATOR) {
+			n++;
+		} else {
+			map[offset++] = n;
+		}
+	}
+	free(folded);
+	if (offset != key_len) {
+		/* Shouldn't happen, but don't trust a map that doesn't fit. */
+		free(map);
+		return NULL;
+	}
+	map[key_len] = utf8_strlen(str);
+	return map;
+}
 
-	return score;
+/*
+ * Convert a byte offset into the folded key of str to the index of the
+ * character of str it's part of. Without a map, the byte offsets line up.
+ */
+uint32_t key_offset_to_char(
+		const char *restrict str,
+		const uint32_t *restrict key_map,
+		size_t offset)
+{
+	if (key_map != NULL) {
+		return key_map[offset];
+	}
+	uint32_t n = 0;
+	for (const char *c = str; *c != '\0' && (size_t)(c - str) < offset; c = utf8_next_char(c)) {
+		n++;
+	}
+	return n;
 }
 
 /*
- * Recursively match the whole of pattern against str.
- * The score parameter is the score of the previously matched character.
- *
- * This reaches a maximum recursion depth of strlen(pattern) + 1. However, the
- * stack usage is small (the maximum I've seen on x86_64 is 144 bytes with
- * gcc -O3), so this shouldn't matter unless pattern contains thousands of
- * characters.
+ * As key_offset_to_char(), but for the end of a match, so a character that's
+ * only partly matched (e.g. "e" of a decomposed "é") is included.
  */
-int32_t fuzzy_match_recurse(
-		const char *restrict pattern,
+uint32_t key_end_to_char(
 		const char *restrict str,
-		int32_t score,
-		bool first_match_only,
-		bool first_char)
+		const uint32_t *restrict key_map,
+		size_t end)
 {
-	if (*pattern == '\0') {
-		/* We've matched the full pattern. */
-		return score;
+	if (key_map != NULL && end > 0) {
+		return key_map[end - 1] + 1;
 	}
+	return key_offset_to_char(str, key_map, end);
+}
 
-	const char *match = str;
-	uint32_t search = utf8_to_utf32(pattern);
+/*
+ * Perform simple matching of each word in query against key.
+ * Returns the negative sum of substring distances from the start of key.
+ * If a word is not found, returns INT32_MIN.
+ */
+int32_t simple_match_words(
+		const struct compiled_query *restrict query,
+		const char *restrict str,
+		const char *restrict key,
+		const uint32_t *restrict key_map,
+		struct match_spans *restrict spans)
+{
+	char *tmp = NULL;
+	if (key == NULL) {
+		tmp = utf8_fold(str);
+		key = tmp ? tmp : str;
+	}
 
-	int32_t best_score = INT32_MIN;
+	size_t first = 0;
+	uint32_t *tmp_map = NULL;
+	if (spans != NULL) {
+		first = spans->count;
+		if (key_map == NULL) {
+			tmp_map = match_key_map(str, key);
+			key_map = tmp_map;
+		}
+	}
 
-	/*
-	 * Find all occurrences of the next pattern character in str, and
-	 * recurse on them.
-	 */
-	while ((match = utf8_strcasechr(match, search)) != NULL) {
-		int32_t jump = 0;
-		for (const char *tmp = str; tmp != match; tmp = utf8_next_char(tmp)) {
-			jump++;
+	int32_t score = 0;
+	for (size_t i = 0; i < query->num_words; i++) {
+		const char *text = query->words[i].text;
+		const char *c = strstr(key, text);
+		if (c == NULL) {
+			score = INT32_MIN;
+			break;
+		}
+		score -= c - key;
+		if (spans != NULL) {
+			size_t offset = c - key;
+			uint32_t start = key_offset_to_char(str, key_map, offset);
+			uint32_t end = key_end_to_char(str, key_map, offset + strlen(text));
+			add_span(spans, start, end - start);
+		}
+	}
+	free(tmp);
+	free(tmp_map);
+
+	if (spans != NULL) {
+		if (score == INT32_MIN) {
+			spans->count = first;
+		} else {
+			merge_spans(spans, first);
 		}
-		int32_t subscore = fuzzy_match_recurse(
-				utf8_next_char(pattern),
-				utf8_next_char(match),
-				compute_score(jump, first_char, match),
-				first_match_only,
-				false);
-		best_score = MAX(best_score, subscore);
-		match = utf8_next_char(match);
-
-		if (first_match_only) {
+	}
+	return score;
+}
+
+/*
+ * Perform prefix matching of each word in query against key.
+ * Returns the negative sum of remaining string suffix lengths.
+ * If a word is not found, returns INT32_MIN.
+ */
+int32_t prefix_match_words(
+		const struct compiled_query *restrict query,
+		const char *restrict str,
+		const char *restrict key,
+		const uint32_t *restrict key_map,
+		struct match_spans *restrict spans)
+{
+	char *tmp = NULL;
+	if (key == NULL) {
+		tmp = utf8_fold(str);
+		key = tmp ? tmp : str;
+	}
+
+	int32_t score = 0;
+	size_t slen = 0;
+	size_t longest = 0;
+	for (size_t i = 0; i < query->num_words; i++) {
+		const struct query_word *word = &query->words[i];
+		size_t len = strlen(word->text);
+		if (strncmp(key, word->text, len) != 0) {
+			score = INT32_MIN;
 			break;
 		}
+		if (slen == 0) {
+			slen = utf8_strlen(str);
+		}
+		score -= slen - word->length;
+		longest = MAX(longest, len);
 	}
 
-	if (best_score == INT32_MIN) {
-		/* We couldn't match the rest of the pattern. */
-		return INT32_MIN;
-	} else {
-		return score + best_score;
+	/* Every word matches at the start, so only the longest matters. */
+	if (spans != NULL && score != INT32_MIN) {
+		uint32_t *tmp_map = NULL;
+		if (key_map == NULL) {
+			tmp_map = match_key_map(str, key);
+			key_map = tmp_map;
+		}
+		add_span(spans, 0, key_end_to_char(str, key_map, longest));
+		free(tmp_map);
 	}
+	free(tmp);
+	return score;
 }
 
 /*
- * Calculate the score for a single matching letter.
- * The scoring system is taken from fts_fuzzy_match v0.2.0 by Forrest Smith,
- * which is licensed to the public domain.
+ * Scoring constants for the fuzzy matcher. The scoring system is taken from
+ * fts_fuzzy_match v0.2.0 by Forrest Smith, which is licensed to the public
+ * domain.
  *
  * The factors affecting score are:
  *   - Bonuses:
@@ -257,45 +456,262 @@ int32_t fuzzy_match_recurse(
  *
  *   - Penalties:
  *     - If there are letters before the first match.
- *     - If there are superfluous characters in str (already accounted for).
+ *     - If there are superfluous characters in str.
+ */
+static const int32_t adjacency_bonus = 15;
+static const int32_t separator_bonus = 30;
+static const int32_t camel_bonus = 30;
+static const int32_t first_letter_bonus = 15;
+
+static const int32_t leading_letter_penalty = -5;
+static const int32_t max_leading_letter_penalty = -15;
+static const int32_t unmatched_letter_penalty = -1;
+
+/*
+ * Candidates up to this many characters are matched using scratch space on
+ * the stack, longer ones need a heap allocation. Recording match positions
+ * needs a row of scores per character of the word, so gets more room.
+ */
+#define FUZZY_STACK_CHARS 256
+#define FUZZY_STACK_SCORES (16 * FUZZY_STACK_CHARS)
+
+/*
+ * Return the sum of fuzzy_match(word, str) for each word in query.
+ * If a word is not found, returns INT32_MIN.
+ *
+ * str is decoded once up front, along with the bonus each of its characters
+ * would earn if matched, so that each word just has to run the matcher over
+ * plain arrays. key isn't needed, as we compare characters case-insensitively.
  */
-int32_t compute_score(int32_t jump, bool first_char, const char *restrict match)
+int32_t fuzzy_match_words(
+		const struct compiled_query *restrict query,
+		const char *restrict str,
+		const char *restrict key,
+		const uint32_t *restrict key_map,
+		struct match_spans *restrict spans)
 {
-	const int adjacency_bonus = 15;
-	const int separator_bonus = 30;
-	const int camel_bonus = 30;
-	const int first_letter_bonus = 15;
+	(void)key;
+	(void)key_map;
+	if (query->num_words == 0) {
+		return 0;
+	}
 
-	const int leading_letter_penalty = -5;
-	const int max_leading_letter_penalty = -15;
+	const size_t slen = utf8_strlen(str);
+
+	uint32_t stack_chars[FUZZY_STACK_CHARS];
+	int32_t stack_bonuses[FUZZY_STACK_CHARS];
+	int32_t stack_scores[FUZZY_STACK_SCORES];
+	uint32_t *chars = stack_chars;
+	int32_t *bonuses = stack_bonuses;
+	int32_t *scores = stack_scores;
+	if (slen > FUZZY_STACK_CHARS) {
+		chars = xmalloc(slen * sizeof(*chars));
+		bonuses = xmalloc(slen * sizeof(*bonuses));
+	}
+
+	size_t rows = 1;
+	size_t first = 0;
+	if (spans != NULL) {
+		first = spans->count;
+		for (size_t i = 0; i < query->num_words; i++) {
+			rows = MAX(rows, query->words[i].length);
+		}
+	}
+	if (rows * slen > FUZZY_STACK_SCORES) {
+		scores = xmalloc(rows * slen * sizeof(*scores));
+	}
+
+	uint32_t prev = 0;
+	const char *c = str;
+	for (size_t i = 0; i < slen; i++) {
+		uint32_t cur = utf8_to_utf32(c);
+		chars[i] = utf32_tolower(cur);
+		bonuses[i] = compute_bonus(i, cur, prev);
+		prev = cur;
+		c = utf8_next_char(c);
+	}
 
 	int32_t score = 0;
+	for (size_t i = 0; i < query->num_words; i++) {
+		int32_t word_score = fuzzy_match(&query->words[i], slen, chars, bonuses, scores, spans);
+		if (word_score == INT32_MIN) {
+			score = INT32_MIN;
+			break;
+		}
+		score += word_score;
+	}
+
+	if (spans != NULL) {
+		if (score == INT32_MIN) {
+			spans->count = first;
+		} else {
+			merge_spans(spans, first);
+		}
+	}
+
+	if (chars != stack_chars) {
+		free(chars);
+		free(bonuses);
+	}
+	if (scores != stack_scores) {
+		free(scores);
+	}
+	return score;
+}
+
+/*
+ * Returns the best score if each character in word is found sequentially
+ * within the decoded string chars, or INT32_MIN otherwise.
+ *
+ * This is a dynamic programming matcher, similar to Smith-Waterman or fzf's
+ * v2 algorithm. Each pass over chars matches one more character of the
+ * pattern, and scores[j] holds the best score of a match of the pattern so
+ * far that ends at chars[j]. That makes the cost O(plen * slen) rather than
+ * the number of possible placements of the pattern, which grows roughly as
+ * slen^plen, and we only need one row of scratch space.
+ *
+ * If spans isn't NULL, scores instead has room for plen rows, which are all
+ * kept so that the best match can be traced back to find its characters.
+ *
+ * A match's score is the sum of the bonuses of its characters, plus the
+ * adjacency bonus for each pair of consecutive matches, and the leading
+ * letter penalty for characters before the first match.
+ */
+int32_t fuzzy_match(
+		const struct query_word *restrict word,
+		size_t slen,
+		const uint32_t *restrict chars,
+		const int32_t *restrict bonuses,
+		int32_t *restrict scores,
+		struct match_spans *restrict spans)
+{
+	const size_t plen = word->length;
 
-	const uint32_t cur = utf8_to_utf32(match);
+	if (slen < plen) {
+		return INT32_MIN;
+	}
 
-	/* Apply bonuses. */
-	if (!first_char && jump == 0) {
-		score += adjacency_bonus;
+	/* First character of the word. */
+	int32_t *row = scores;
+	uint32_t search = word->chars[0];
+	for (size_t j = 0; j < slen; j++) {
+		if (chars[j] == search) {
+			int32_t penalty = MAX(
+					leading_letter_penalty * (int32_t)MIN(j, 3),
+					max_leading_letter_penalty);
+			row[j] = bonuses[j] + penalty;
+		} else {
+			row[j] = INT32_MIN;
+		}
 	}
-	if (!first_char || jump > 0) {
-		const uint32_t prev = utf8_to_utf32(utf8_prev_char(match));
-		if (utf32_isupper(cur) && utf32_islower(prev)) {
-			score += camel_bonus;
+
+	/*
+	 * Remaining characters, updating scores in place unless we need to
+	 * keep every row.
+	 */
+	for (size_t k = 1; k < plen; k++) {
+		const int32_t *prev = row;
+		if (spans != NULL) {
+			row += slen;
 		}
-		if (utf32_isalnum(cur) && !utf32_isalnum(prev)) {
-			score += separator_bonus;
+		search = word->chars[k];
+		/* Best previous score ending at least two characters back. */
+		int32_t gap = INT32_MIN;
+		/* Previous score ending at the character just before j. */
+		int32_t diagonal = INT32_MIN;
+		for (size_t j = 0; j < slen; j++) {
+			int32_t best = INT32_MIN;
+			if (chars[j] == search) {
+				if (diagonal != INT32_MIN) {
+					best = diagonal + adjacency_bonus;
+				}
+				best = MAX(best, gap);
+				if (best != INT32_MIN) {
+					best += bonuses[j];
+				}
+			}
+			gap = MAX(gap, diagonal);
+			diagonal = prev[j];
+			row[j] = best;
 		}
 	}
-	if (first_char && jump == 0) {
-		/* Match at start of string gets separator bonus. */
-		score += first_letter_bonus;
+
+	int32_t best_score = INT32_MIN;
+	size_t best_end = 0;
+	for (size_t j = 0; j < slen; j++) {
+		if (row[j] > best_score) {
+			best_score = row[j];
+			best_end = j;
+		}
+	}
+	if (best_score == INT32_MIN) {
+		return INT32_MIN;
 	}
 
-	/* Apply penalties. */
-	if (first_char) {
-		score += MAX(leading_letter_penalty * jump,
-				max_leading_letter_penalty);
+	if (spans != NULL) {
+		fuzzy_backtrack(plen, slen, bonuses, scores, best_end, spans);
 	}
 
-	return score;
+	/* Penalise any unused letters. */
+	return best_score + unmatched_letter_penalty * (int32_t)(slen - plen);
+}
+
+/*
+ * Trace the best match found by fuzzy_match() back from its last character at
+ * end, adding each run of consecutive matched characters to spans.
+ *
+ * Each score is the bonus of its character plus the best score of the
+ * previous row that it could follow, so we just have to find that score.
+ * An adjacent match is preferred when there's a tie, giving longer runs.
+ */
+void fuzzy_backtrack(
+		size_t plen,
+		size_t slen,
+		const int32_t *restrict bonuses,
+		const int32_t *restrict scores,
+		size_t end,
+		struct match_spans *restrict spans)
+{
+	size_t j = end;
+	size_t run_end = end + 1;
+	for (size_t k = plen - 1; k > 0; k--) {
+		const int32_t *prev = &scores[(k - 1) * slen];
+		int32_t target = scores[k * slen + j] - bonuses[j];
+		size_t i = j - 1;
+		if (prev[i] == INT32_MIN || prev[i] + adjacency_bonus != target) {
+			/* Not adjacent, so there must be a gap. */
+			i = j - 2;
+			while (prev[i] != target) {
+				i--;
+			}
+			add_span(spans, j, run_end - j);
+			run_end = i + 1;
+		}
+		j = i;
+	}
+	add_span(spans, j, run_end - j);
+}
+
+/*
+ * Calculate the bonus for matching the character cur at the given index of
+ * a string, where prev is the character before it.
+ *
+ * A match of the first character of the pattern at the start of the string
+ * gets the first letter bonus instead. Later pattern characters can never
+ * match at the start.
+ */
+int32_t compute_bonus(size_t index, uint32_t cur, uint32_t prev)
+{
+	if (index == 0) {
+		return first_letter_bonus;
+	}
+
+	int32_t bonus = 0;
+	if (utf32_isupper(cur) && utf32_islower(prev)) {
+		bonus += camel_bonus;
+	}
+	if (utf32_isalnum(cur) && !utf32_isalnum(prev)) {
+		bonus += separator_bonus;
+	}
+	return bonus;
 }
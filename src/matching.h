@@ -1,6 +1,8 @@
 #ifndef MATCHING_H
 #define MATCHING_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 enum matching_algorithm {
@@ -9,6 +11,121 @@ enum matching_algorithm {
 	MATCHING_ALGORITHM_FUZZY
 };
 
-int32_t match_words(enum matching_algorithm algorithm, const char *restrict patterns, const char *restrict str);
+struct compiled_query;
+
+/* A run of matched characters in a candidate, counted in codepoints. */
+struct match_span {
+	uint32_t start;
+	uint32_t length;
+};
+
+/* A growable list of spans, reused from one call to the next. */
+struct match_spans {
+	size_t count;
+	size_t size;
+	struct match_span *buf;
+};
+
+/*
+ * Match a compiled query against str, whose folded form (see utf8_fold()) is
+ * key, and return its score. Larger scores are better matches, and INT32_MIN
+ * means no match. If key is NULL, it's computed as needed.
+ *
+ * If spans isn't NULL, the characters of str that matched are appended to it
+ * as sorted, non-overlapping runs, for highlighting. Nothing is appended if
+ * there's no match. This is much more work than just scoring, so is only
+ * done for results that are actually drawn. key_map is key's map from
+ * match_key_map(), if it has one, and is only needed for spans.
+ */
+typedef int32_t (*matcher_fn)(
+		const struct compiled_query *restrict query,
+		const char *restrict str,
+		const char *restrict key,
+		const uint32_t *restrict key_map,
+		struct match_spans *restrict spans);
+
+struct query_word {
+	/*
+	 * The word itself. This is case-folded for the simple and prefix
+	 * matchers, which compare it against a candidate's folded key. The
+	 * fuzzy matcher needs the original case of the candidate for its
+	 * camel-case bonus, so its words are just normalised.
+	 */
+	const char *text;
+	/* The lower-cased characters of text, and how many there are. */
+	const uint32_t *chars;
+	size_t length;
+	/* The characters a candidate must contain, see match_mask(). */
+	uint64_t mask;
+};
+
+/*
+ * A user's query, split into words and pre-processed once per keystroke, so
+ * that matching it against each candidate doesn't need to re-parse or
+ * allocate anything. match is the matcher for the chosen algorithm.
+ */
+struct compiled_query {
+	enum matching_algorithm algorithm;
+	matcher_fn match;
+	size_t num_words;
+	struct query_word *words;
+	uint64_t mask;
+	char *text;
+	uint32_t *chars;
+};
+
+[[nodiscard("memory leaked")]]
+struct compiled_query compiled_query_create(
+		enum matching_algorithm algorithm,
+		const char *restrict patterns);
+
+void compiled_query_destroy(struct compiled_query *query);
+
+/*
+ * Character-presence masks allow quick rejection of candidates before running
+ * a matcher. A candidate can only match if its mask contains every bit of the
+ * query's mask. Only ASCII characters are tracked, so other characters don't
+ * constrain the match.
+ */
+uint64_t match_mask(const char *restrict str, const char *restrict key);
+
+/*
+ * Folding (see utf8_fold()) can change the length of a character, e.g. by
+ * decomposing an accented letter, which throws the byte offsets in key out
+ * of line with those in str. For such keys, return a map from each byte
+ * offset in key (up to and including its end) to the number of characters
+ * of str before it, so that matches in key can be found in str. Otherwise,
+ * return NULL.
+ *
+ * This is meant to be built once, alongside key, by whoever owns it.
+ */
+[[nodiscard("memory leaked")]]
+uint32_t *match_key_map(const char *restrict str, const char *restrict key);
+
+static inline bool match_mask_possible(uint64_t mask, uint64_t query_mask)
+{
+	return (mask & query_mask) == query_mask;
+}
+
+static inline int32_t match_words(
+		const struct compiled_query *restrict query,
+		const char *restrict str,
+		const char *restrict key)
+{
+	return query->match(query, str, key, NULL, NULL);
+}
+
+/* Match again, appending the characters of str that matched to spans. */
+static inline int32_t match_words_spans(
+		const struct compiled_query *restrict query,
+		const char *restrict str,
+		const char *restrict key,
+		const uint32_t *restrict key_map,
+		struct match_spans *restrict spans)
+{
+	return query->match(query, str, key, key_map, spans);
+}
+
+void match_spans_destroy(struct match_spans *spans);
 
 #endif /* MATCHING_H */
@@ -1,101 +1,212 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "list_stream.h"
 #include "log.h"
+#include "matching.h"
 #include "nav.h"
 #include "xmalloc.h"
 
-struct value_dict *dict_create(void)
+/*
+ * value_dicts are small open-addressed hash tables. Values shorter than
+ * DICT_INLINE_VALUE are stored in the entry itself, and longer ones are
+ * spilled to the heap.
+ *
+ * Dicts are passed down from level to level, and most levels never add a
+ * binding of their own, so copies are copy-on-write: dict_copy() just takes
+ * a reference, and dict_set() makes a private copy of a shared dict first.
+ */
+#define DICT_INLINE_VALUE 24
+#define DICT_MIN_CAPACITY 8
+
+struct dict_entry {
+	char key[NAV_KEY_MAX];
+	uint32_t hash;
+	uint32_t length;
+	union {
+		char inline_value[DICT_INLINE_VALUE];
+		char *heap_value;
+	};
+};
+
+struct value_dict {
+	unsigned int refs;
+	uint32_t count;
+	uint32_t capacity;
+	struct dict_entry entries[];
+};
+
+static uint32_t dict_hash(const char *key)
 {
-	return NULL;
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+	for (const char *c = key; *c != '\0'; c++) {
+		hash ^= (unsigned char)*c;
+		hash *= 16777619u;
+	}
+	return hash;
 }
 
-struct value_dict *dict_copy(struct value_dict *src)
+static bool entry_used(const struct dict_entry *entry)
 {
-	if (!src) {
-		return NULL;
+	return entry->key[0] != '\0';
+}
+
+static const char *entry_value(const struct dict_entry *entry)
+{
+	if (entry->length < DICT_INLINE_VALUE) {
+		return entry->inline_value;
 	}
-	
-	struct value_dict *head = NULL;
-	struct value_dict *tail = NULL;
-	struct value_dict *curr = src;
-	
-	while (curr) {
-		struct value_dict *entry = xcalloc(1, sizeof(*entry));
-		strncpy(entry->key, curr->key, NAV_KEY_MAX - 1);
-		strncpy(entry->value, curr->value, NAV_VALUE_MAX - 1);
-		entry->next = NULL;
-		
-		if (!head) {
-			head = entry;
-		} else {
-			tail->next = entry;
+	return entry->heap_value;
+}
+
+static void entry_set_value(struct dict_entry *entry, const char *value)
+{
+	/* value may be the old value, so only free that at the end. */
+	char *old = NULL;
+	if (entry_used(entry) && entry->length >= DICT_INLINE_VALUE) {
+		old = entry->heap_value;
+	}
+	size_t length = strlen(value);
+	if (length < DICT_INLINE_VALUE) {
+		memmove(entry->inline_value, value, length + 1);
+	} else {
+		entry->heap_value = xstrdup(value);
+	}
+	entry->length = length;
+	free(old);
+}
+
+/*
+ * Return the entry for key, or the empty slot it should go in. The table is
+ * never full, so this always terminates.
+ */
+static struct dict_entry *dict_find(const struct value_dict *dict, const char *key, uint32_t hash)
+{
+	uint32_t mask = dict->capacity - 1;
+	for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+		const struct dict_entry *entry = &dict->entries[i];
+		if (!entry_used(entry)
+				|| (entry->hash == hash && strcmp(entry->key, key) == 0)) {
+			return (struct dict_entry *)entry;
 		}
-		tail = entry;
-		curr = curr->next;
 	}
-	
-	return head;
 }
 
-const char *dict_get(struct value_dict *dict, const char *key)
+static struct value_dict *dict_alloc(uint32_t capacity)
+{
+	struct value_dict *dict = xcalloc(1, sizeof(*dict) + capacity * sizeof(dict->entries[0]));
+	dict->refs = 1;
+	dict->capacity = capacity;
+	return dict;
+}
+
+/*
+ * Rehash src into a new table of the given capacity. If src is still in use,
+ * spilled values are duplicated, otherwise they're moved and src should just
+ * be freed afterwards.
+ */
+static struct value_dict *dict_rehash(const struct value_dict *src, uint32_t capacity, bool keep_src)
 {
-	struct value_dict *curr = dict;
-	while (curr) {
-		if (strcmp(curr->key, key) == 0) {
-			return curr->value;
+	struct value_dict *dict = dict_alloc(capacity);
+	for (uint32_t i = 0; i < src->capacity; i++) {
+		const struct dict_entry *entry = &src->entries[i];
+		if (!entry_used(entry)) {
+			continue;
+		}
+		struct dict_entry *slot = dict_find(dict, entry->key, entry->hash);
+		*slot = *entry;
+		if (keep_src && entry->length >= DICT_INLINE_VALUE) {
+			slot->heap_value = xstrdup(entry->heap_value);
 		}
-		curr = curr->next;
 	}
+	dict->count = src->count;
+	return dict;
+}
+
+struct value_dict *dict_create(void)
+{
 	return NULL;
 }
 
+struct value_dict *dict_copy(struct value_dict *src)
+{
+	if (src) {
+		src->refs++;
+	}
+	return src;
+}
+
+const char *dict_get(struct value_dict *dict, const char *key)
+{
+	if (!dict || !key[0]) {
+		return NULL;
+	}
+	const struct dict_entry *entry = dict_find(dict, key, dict_hash(key));
+	if (!entry_used(entry)) {
+		return NULL;
+	}
+	return entry_value(entry);
+}
+
 void dict_set(struct value_dict **dict, const char *key, const char *value)
 {
-	if (!*dict) {
-		struct value_dict *entry = xcalloc(1, sizeof(*entry));
-		strncpy(entry->key, key, NAV_KEY_MAX - 1);
-		strncpy(entry->value, value, NAV_VALUE_MAX - 1);
-		entry->next = NULL;
-		*dict = entry;
+	if (!key[0]) {
 		return;
 	}
 	
-	struct value_dict *curr = *dict;
-	while (curr) {
-		if (strcmp(curr->key, key) == 0) {
-			strncpy(curr->value, value, NAV_VALUE_MAX - 1);
-			return;
-		}
-		if (!curr->next) {
-			break;
-		}
-		curr = curr->next;
+	struct value_dict *d = *dict;
+	if (!d) {
+		d = dict_alloc(DICT_MIN_CAPACITY);
+	} else if (d->refs > 1) {
+		d->refs--;
+		d = dict_rehash(d, d->capacity, true);
 	}
 	
-	struct value_dict *entry = xcalloc(1, sizeof(*entry));
-	strncpy(entry->key, key, NAV_KEY_MAX - 1);
-	strncpy(entry->value, value, NAV_VALUE_MAX - 1);
-	entry->next = NULL;
+	/*
+	 * Keep the load factor at or below 1/2. value might point into the
+	 * old table, so don't free it until we're done.
+	 */
+	struct value_dict *old = NULL;
+	if ((d->count + 1) * 2 > d->capacity) {
+		old = d;
+		d = dict_rehash(old, old->capacity * 2, false);
+	}
+	*dict = d;
 	
-	if (curr) {
-		curr->next = entry;
+	char truncated[NAV_KEY_MAX];
+	snprintf(truncated, sizeof(truncated), "%s", key);
+	uint32_t hash = dict_hash(truncated);
+	struct dict_entry *entry = dict_find(d, truncated, hash);
+	if (!entry_used(entry)) {
+		entry_set_value(entry, value);
+		memcpy(entry->key, truncated, sizeof(truncated));
+		entry->hash = hash;
+		d->count++;
+	} else {
+		entry_set_value(entry, value);
 	}
+	free(old);
 }
 
 void dict_destroy(struct value_dict *dict)
 {
-	struct value_dict *curr = dict;
-	while (curr) {
-		struct value_dict *next = curr->next;
-		free(curr);
-		curr = next;
+	if (!dict || --dict->refs > 0) {
+		return;
 	}
+	for (uint32_t i = 0; i < dict->capacity; i++) {
+		const struct dict_entry *entry = &dict->entries[i];
+		if (entry_used(entry) && entry->length >= DICT_INLINE_VALUE) {
+			free(entry->heap_value);
+		}
+	}
+	free(dict);
 }
 
 struct action_def *action_def_create(void)
 {
 	struct action_def *action = xcalloc(1, sizeof(*action));
+	action->refs = 1;
 	action->selection_type = SELECTION_SELF;
 	action->execution_type = EXECUTION_EXEC;
 	action->on_select = NULL;
@@ -105,98 +216,146 @@ struct action_def *action_def_create(void)
 	return action;
 }
 
-struct action_def *action_def_copy(struct action_def *src)
+static void action_def_free_compiled(struct action_def *action)
 {
-	if (!src) {
-		return NULL;
+	template_destroy(action->compiled.template);
+	template_destroy(action->compiled.prompt);
+	template_destroy(action->compiled.eval_cmd);
+	template_destroy(action->compiled.display_input);
+	template_destroy(action->compiled.display_result);
+}
+
+/*
+ * (Re)compile the templates of action and its on_select chain. This should
+ * be called whenever their text is changed.
+ */
+void action_def_compile(struct action_def *action)
+{
+	for (; action; action = action->on_select) {
+		action_def_free_compiled(action);
+		action->compiled.template = template_compile(action->template);
+		action->compiled.prompt = template_compile(action->prompt);
+		action->compiled.eval_cmd = template_compile(action->eval_cmd);
+		action->compiled.display_input = template_compile(action->display_input);
+		action->compiled.display_result = template_compile(action->display_result);
 	}
-	
-	struct action_def *copy = xcalloc(1, sizeof(*copy));
-	*copy = *src;
-	copy->on_select = NULL;
-	
-	if (src->on_select) {
-		copy->on_select = action_def_copy(src->on_select);
+}
+
+struct action_def *action_def_ref(struct action_def *action)
+{
+	if (action) {
+		action->refs++;
 	}
-	
-	return copy;
+	return action;
 }
 
-void action_def_destroy(struct action_def *action)
+void action_def_unref(struct action_def *action)
 {
-	if (!action) {
+	if (!action || --action->refs > 0) {
 		return;
 	}
-	if (action->on_select) {
-		action_def_destroy(action->on_select);
-	}
+	action_def_unref(action->on_select);
+	action_def_free_compiled(action);
 	free(action);
 }
 
-struct nav_result *nav_result_create(void)
+struct nav_result *nav_result_create(struct arena *arena)
 {
-	struct nav_result *result = xcalloc(1, sizeof(*result));
+	struct nav_result *result = arena_alloc(arena, sizeof(*result));
+	*result = (struct nav_result){
+		.source_plugin = "",
+		/* The label isn't known yet, so this mustn't reject anything. */
+		.mask = UINT64_MAX,
+	};
 	return result;
 }
 
-void nav_result_destroy(struct nav_result *result)
+void nav_view_destroy(struct nav_view *view)
 {
-	if (!result) {
-		return;
+	free(view->buf);
+	view->buf = NULL;
+	view->count = 0;
+	view->size = 0;
+}
+
+static void nav_view_add(struct nav_view *view, struct nav_result *result)
+{
+	if (view->count == view->size) {
+		view->size = view->size ? view->size * 2 : 128;
+		view->buf = xrealloc(view->buf, view->size * sizeof(*view->buf));
 	}
-	action_def_destroy(result->action.on_select);
-	free(result);
+	view->buf[view->count++] = result;
 }
 
-void nav_results_destroy(struct wl_list *results)
+/* Add res to view, and its label to labels, if it matches query. */
+static void filter_result(
+		struct nav_view *view,
+		struct nav_result *res,
+		const struct compiled_query *query,
+		struct string_ref_vec *labels)
 {
-	if (!results || results->prev == NULL || results->next == NULL) {
+	if (!match_mask_possible(res->mask, query->mask)) {
 		return;
 	}
-	
-	struct nav_result *result, *tmp;
-	wl_list_for_each_safe(result, tmp, results, link) {
-		wl_list_remove(&result->link);
-		nav_result_destroy(result);
+	if (query->num_words == 0 || match_words(query, res->label, NULL) > 0) {
+		nav_view_add(view, res);
+		string_ref_vec_add(labels, res->label);
+		labels->buf[labels->count - 1].data = res;
 	}
 }
 
-struct nav_result *nav_results_copy_single(struct nav_result *src)
+/*
+ * Point view at the results in src whose labels fuzzy-match filter, and add
+ * their labels to labels, each pointing back at its result. The view's
+ * storage is reused, so this doesn't allocate once it has grown large enough.
+ */
+void nav_results_filter(
+		struct nav_view *view,
+		struct wl_list *src,
+		const char *filter,
+		struct string_ref_vec *labels)
 {
-	if (!src) {
-		return NULL;
-	}
+	struct compiled_query query = compiled_query_create(
+			MATCHING_ALGORITHM_FUZZY,
+			filter ? filter : "");
 	
-	struct nav_result *copy = nav_result_create();
-	strncpy(copy->label, src->label, NAV_LABEL_MAX - 1);
-	strncpy(copy->value, src->value, NAV_VALUE_MAX - 1);
-	copy->action = src->action;
-	
-	if (src->action.on_select) {
-		copy->action.on_select = action_def_copy(src->action.on_select);
-	} else {
-		copy->action.on_select = NULL;
+	view->count = 0;
+	struct nav_result *res;
+	wl_list_for_each(res, src, link) {
+		filter_result(view, res, &query, labels);
 	}
-	
-	return copy;
+	compiled_query_destroy(&query);
 }
 
-void nav_results_copy(struct wl_list *dest, struct wl_list *src)
+void nav_level_show_all(struct nav_level *level)
 {
-	wl_list_init(dest);
+	level->view.count = 0;
+	string_ref_vec_destroy(&level->labels);
+	level->labels = string_ref_vec_create();
 	struct nav_result *res;
-	wl_list_for_each(res, src, link) {
-		struct nav_result *copy = nav_result_create();
-		strncpy(copy->label, res->label, NAV_LABEL_MAX - 1);
-		strncpy(copy->value, res->value, NAV_VALUE_MAX - 1);
-		copy->action = res->action;
-		if (res->action.on_select) {
-			copy->action.on_select = action_def_copy(res->action.on_select);
-		}
-		wl_list_insert(dest, &copy->link);
+	wl_list_for_each(res, &level->results, link) {
+		res->mask = match_mask(res->label, NULL);
+		nav_view_add(&level->view, res);
+		string_ref_vec_add(&level->labels, res->label);
+		level->labels.buf[level->labels.count - 1].data = res;
 	}
 }
 
+void nav_level_add_results(struct nav_level *level, struct wl_list *results, const char *filter)
+{
+	struct compiled_query query = compiled_query_create(
+			MATCHING_ALGORITHM_FUZZY,
+			filter ? filter : "");
+	
+	struct nav_result *res;
+	wl_list_for_each(res, results, link) {
+		res->mask = match_mask(res->label, NULL);
+		filter_result(&level->view, res, &query, &level->labels);
+	}
+	compiled_query_destroy(&query);
+	wl_list_insert_list(level->results.prev, results);
+}
+
 struct nav_level *nav_level_create(selection_type_t mode, struct value_dict *dict)
 {
 	struct nav_level *level = xcalloc(1, sizeof(*level));
@@ -213,7 +372,7 @@ struct nav_level *nav_level_create(selection_type_t mode, struct value_dict *dic
 	level->persist_history = false;
 	level->feedback_loading = false;
 	wl_list_init(&level->results);
-	wl_list_init(&level->backup_results);
+	level->labels = string_ref_vec_create();
 	return level;
 }
 
@@ -223,84 +382,142 @@ void nav_level_destroy(struct nav_level *level)
 		return;
 	}
 	
+	/* The stream's results borrow on_select, so it goes first. */
+	list_stream_destroy(level->stream);
 	dict_destroy(level->dict);
-	action_def_destroy(level->on_select);
+	action_def_unref(level->action);
+	action_def_unref(level->on_select);
 	
+	/*
+	 * Results live in the arena, but feedback entries come and go for as
+	 * long as the level is open, so each has its own allocation.
+	 */
 	if (level->mode == SELECTION_FEEDBACK) {
-		feedback_entries_destroy(&level->results);
-		feedback_entries_destroy(&level->backup_results);
-	} else {
-		nav_results_destroy(&level->results);
-		nav_results_destroy(&level->backup_results);
+		struct feedback_entry *entry, *tmp;
+		wl_list_for_each_safe(entry, tmp, &level->results, link) {
+			wl_list_remove(&entry->link);
+			feedback_entry_destroy(entry);
+		}
 	}
+	nav_view_destroy(&level->view);
+	string_ref_vec_destroy(&level->labels);
+	arena_destroy(&level->arena);
 	free(level);
 }
 
-struct feedback_entry *feedback_entry_create(void)
+struct feedback_entry *feedback_entry_create(bool is_user, const char *content)
 {
-	struct feedback_entry *entry = xcalloc(1, sizeof(*entry));
-	entry->is_user = false;
-	entry->content[0] = '\0';
+	/* The content is stored straight after the entry, in one allocation. */
+	size_t len = strnlen(content, NAV_VALUE_MAX - 1);
+	struct feedback_entry *entry = xmalloc(sizeof(*entry) + len + 1);
+	entry->is_user = is_user;
+	entry->content = (char *)(entry + 1);
+	memcpy(entry->content, content, len);
+	entry->content[len] = '\0';
 	return entry;
 }
 
 void feedback_entry_destroy(struct feedback_entry *entry)
 {
-	if (entry) {
-		free(entry);
-	}
+	free(entry);
 }
 
-void feedback_entries_destroy(struct wl_list *entries)
+struct template *template_compile(const char *text)
 {
-	if (!entries || entries->prev == NULL || entries->next == NULL) {
-		return;
+	if (!text || !text[0]) {
+		return NULL;
+	}
+	
+	/*
+	 * Each key can be followed by at most one literal, and the segment
+	 * text is at most a copy of the source with a terminator after each
+	 * key, so size everything for the worst case and store it all in one
+	 * allocation.
+	 */
+	size_t text_len = strlen(text);
+	size_t num_keys = 0;
+	for (const char *c = strchr(text, '{'); c; c = strchr(c + 1, '{')) {
+		num_keys++;
 	}
+	size_t max_segments = 2 * num_keys + 1;
+	struct template *template = xmalloc(
+			sizeof(*template)
+			+ max_segments * sizeof(template->segments[0])
+			+ text_len + num_keys + 1);
+	char *storage = (char *)&template->segments[max_segments];
+	template->num_segments = 0;
+	template->literal_length = 0;
 	
-	struct feedback_entry *entry, *tmp;
-	wl_list_for_each_safe(entry, tmp, entries, link) {
-		wl_list_remove(&entry->link);
-		feedback_entry_destroy(entry);
+	const char *c = text;
+	while (*c) {
+		struct template_segment *segment = &template->segments[template->num_segments++];
+		segment->text = storage;
+		if (*c == '{') {
+			c++;
+			size_t len = strcspn(c, "}");
+			/* Keys longer than a dict can store would never match. */
+			segment->length = len < NAV_KEY_MAX - 1 ? len : NAV_KEY_MAX - 1;
+			segment->is_key = true;
+			memcpy(storage, c, segment->length);
+			storage[segment->length] = '\0';
+			storage += segment->length + 1;
+			c += len;
+			if (*c == '}') {
+				c++;
+			}
+		} else {
+			size_t len = strcspn(c, "{");
+			segment->length = len;
+			segment->is_key = false;
+			memcpy(storage, c, len);
+			storage += len;
+			template->literal_length += len;
+			c += len;
+		}
 	}
+	
+	return template;
 }
 
-char *template_resolve(const char *template, struct value_dict *dict)
+void template_destroy(struct template *template)
+{
+	free(template);
+}
+
+char *template_resolve(const struct template *template, struct value_dict *dict)
 {
 	if (!template) {
 		return NULL;
 	}
 	
-	size_t template_len = strlen(template);
-	char *result = xcalloc(1, template_len * 2 + NAV_VALUE_MAX + 1);
-	size_t result_len = 0;
-	size_t i = 0;
-	
-	while (template[i]) {
-		if (template[i] == '{') {
-			char key[NAV_KEY_MAX];
-			size_t key_idx = 0;
-			i++;
-			
-			while (template[i] && template[i] != '}' && key_idx < NAV_KEY_MAX - 1) {
-				key[key_idx++] = template[i++];
-			}
-			key[key_idx] = '\0';
-			
-			if (template[i] == '}') {
-				i++;
-			}
-			
-			const char *value = dict_get(dict, key);
+	size_t length = template->literal_length;
+	for (size_t i = 0; i < template->num_segments; i++) {
+		const struct template_segment *segment = &template->segments[i];
+		if (segment->is_key) {
+			const char *value = dict_get(dict, segment->text);
 			if (value) {
-				size_t value_len = strlen(value);
-				memcpy(result + result_len, value, value_len);
-				result_len += value_len;
+				length += strlen(value);
 			}
-		} else {
-			result[result_len++] = template[i++];
 		}
 	}
 	
-	result[result_len] = '\0';
+	char *result = xmalloc(length + 1);
+	char *out = result;
+	for (size_t i = 0; i < template->num_segments; i++) {
+		const struct template_segment *segment = &template->segments[i];
+		const char *text = segment->text;
+		size_t len = segment->length;
+		if (segment->is_key) {
+			text = dict_get(dict, segment->text);
+			if (!text) {
+				continue;
+			}
+			len = strlen(text);
+		}
+		memcpy(out, text, len);
+		out += len;
+	}
+	*out = '\0';
+	
 	return result;
 }
@@ -3,7 +3,9 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <wayland-client.h>
+#include "arena.h"
 #include "string_vec.h"
 
 #define NAV_KEY_MAX 32
@@ -16,6 +18,8 @@
 #define NAV_NAME_MAX 64
 #define NAV_INPUT_MAX 256
 
+struct list_stream;
+
 typedef enum {
 	SELECTION_SELF,
 	SELECTION_INPUT,
@@ -34,13 +38,47 @@ typedef enum {
 	FORMAT_JSON,
 } format_t;
 
-struct value_dict {
-	char key[NAV_KEY_MAX];
-	char value[NAV_VALUE_MAX];
-	struct value_dict *next;
+/*
+ * A set of named values bound along the way to the current level, for use
+ * in templates. An empty dict is just NULL.
+ */
+struct value_dict;
+
+/*
+ * A template such as "notify-send {title}", split when it's loaded into
+ * literal text and {key} slots, so resolving it is just a size computation,
+ * one allocation and some copying. An empty template compiles to NULL.
+ */
+struct template_segment {
+	const char *text;
+	size_t length;
+	bool is_key;
+};
+
+struct template {
+	size_t num_segments;
+	size_t literal_length;
+	struct template_segment segments[];
+};
+
+/*
+ * How long the output of an action's list_cmd may be reused for, in seconds,
+ * and whether to keep it on disk between runs (see provider_cache.h). A ttl
+ * of 0, the default, turns caching off.
+ */
+struct cache_policy {
+	uint32_t ttl;
+	bool persist;
 };
 
+/*
+ * Action definitions are shared between every result (and level) that uses
+ * them, so they're reference counted rather than copied. Take a reference
+ * with action_def_ref() and drop it with action_def_unref().
+ */
 struct action_def {
+	unsigned int refs;
+	
 	selection_type_t selection_type;
 	execution_type_t execution_type;
 	
@@ -53,6 +91,7 @@ struct action_def {
 	format_t format;
 	char label_field[NAV_FIELD_MAX];
 	char value_field[NAV_FIELD_MAX];
+	struct cache_policy cache;
 	
 	struct action_def *on_select;
 	
@@ -65,20 +104,47 @@ struct action_def {
 	int history_limit;
 	bool persist_history;
 	char history_name[NAV_NAME_MAX];
+	
+	/* Compiled versions of the templates above, see action_def_compile(). */
+	struct {
+		struct template *template;
+		struct template *prompt;
+		struct template *eval_cmd;
+		struct template *display_input;
+		struct template *display_result;
+	} compiled;
 };
 
+/*
+ * A single selectable result. Results and their label and value strings are
+ * allocated from the arena of whoever created them (see nav_level.arena), and
+ * are never freed individually. source_plugin and action are borrowed from
+ * the plugin or level that produced the result, which outlives it.
+ */
 struct nav_result {
 	struct wl_list link;
-	char label[NAV_LABEL_MAX];
-	char value[NAV_VALUE_MAX];
-	char source_plugin[NAV_NAME_MAX];
-	struct action_def action;
+	char *label;
+	char *value;
+	const char *source_plugin;
+	struct action_def *action;
+	uint64_t mask;
+};
+
+/*
+ * The results of a level that match its current filter, in display order.
+ * These are just pointers into the level's results, which once populated are
+ * only ever appended to, while the level's list command is still running.
+ */
+struct nav_view {
+	size_t count;
+	size_t size;
+	struct nav_result **buf;
 };
 
 struct feedback_entry {
 	struct wl_list link;
 	bool is_user;
-	char content[NAV_VALUE_MAX];
+	char *content;
 };
 
 struct nav_level {
@@ -88,8 +154,14 @@ struct nav_level {
 	
 	struct value_dict *dict;
 	
+	/*
+	 * The action that opened this level, which owns the compiled
+	 * templates the level uses.
+	 */
+	struct action_def *action;
+	
 	execution_type_t execution_type;
-	char template[NAV_TEMPLATE_MAX];
+	const struct template *template;
 	
 	char prompt[NAV_PROMPT_MAX];
 	char as[NAV_KEY_MAX];
@@ -104,16 +176,26 @@ struct nav_level {
 	
 	char plugin_ref[NAV_NAME_MAX];
 	
+	/*
+	 * Everything owned by the level's results is allocated from here, so
+	 * the level can be torn down in one go. Feedback entries are trimmed
+	 * as the conversation grows, so they're allocated individually instead.
+	 */
+	struct arena arena;
 	struct wl_list results;
-	struct wl_list backup_results;
+	/* The level's list command, if it's still producing results. */
+	struct list_stream *stream;
+	struct nav_view view;
+	/* What the entry shows for this level: the labels of view, or history. */
+	struct string_ref_vec labels;
 	uint32_t selection;
 	uint32_t first_result;
 	
 	char display_prompt[NAV_PROMPT_MAX];
 	
-	char eval_cmd[NAV_CMD_MAX];
-	char display_input[NAV_TEMPLATE_MAX];
-	char display_result[NAV_TEMPLATE_MAX];
+	const struct template *eval_cmd;
+	const struct template *display_input;
+	const struct template *display_result;
 	bool show_input;
 	int history_limit;
 	bool persist_history;
@@ -128,23 +210,44 @@ void dict_set(struct value_dict **dict, const char *key, const char *value);
 void dict_destroy(struct value_dict *dict);
 
 struct action_def *action_def_create(void);
-struct action_def *action_def_copy(struct action_def *src);
-void action_def_destroy(struct action_def *action);
+void action_def_compile(struct action_def *action);
+struct action_def *action_def_ref(struct action_def *action);
+void action_def_unref(struct action_def *action);
 
-struct nav_result *nav_result_create(void);
-void nav_result_destroy(struct nav_result *result);
-void nav_results_destroy(struct wl_list *results);
-struct nav_result *nav_results_copy_single(struct nav_result *src);
-void nav_results_copy(struct wl_list *dest, struct wl_list *src);
+struct nav_result *nav_result_create(struct arena *arena);
+void nav_view_destroy(struct nav_view *view);
 
-struct feedback_entry *feedback_entry_create(void);
+void nav_results_filter(
+		struct nav_view *view,
+		struct wl_list *src,
+		const char *filter,
+		struct string_ref_vec *labels);
+
+[[nodiscard("memory leaked")]]
+struct feedback_entry *feedback_entry_create(bool is_user, const char *content);
 void feedback_entry_destroy(struct feedback_entry *entry);
-void feedback_entries_destroy(struct wl_list *entries);
 void feedback_history_save(struct nav_level *level);
 
 struct nav_level *nav_level_create(selection_type_t mode, struct value_dict *dict);
 void nav_level_destroy(struct nav_level *level);
 
-char *template_resolve(const char *template, struct value_dict *dict);
+/*
+ * Call once a level's results have been populated, to prepare them for
+ * filtering and show them all.
+ */
+void nav_level_show_all(struct nav_level *level);
+
+/*
+ * Append more results to a level that's already being shown, adding the ones
+ * that match filter to its view.
+ */
+void nav_level_add_results(struct nav_level *level, struct wl_list *results, const char *filter);
+
+[[nodiscard("memory leaked")]]
+struct template *template_compile(const char *text);
+void template_destroy(struct template *template);
+
+[[nodiscard("memory leaked")]]
+char *template_resolve(const struct template *template, struct value_dict *dict);
 
 #endif
@@ -0,0 +1,270 @@
+#include <dirent.h>
+#include <errno.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log.h"
+#include "mkdirp.h"
+#include "path_index.h"
+#include "xmalloc.h"
+
+static const char *default_cache_dir = ".cache";
+static const char *cache_name = "hypr-tofi/path";
+
+struct path_dir {
+	char *path;
+	struct timespec mtime;
+	/* Each name in the directory, NUL-terminated, then an empty one. */
+	char *names;
+	size_t names_length;
+};
+
+struct path_index {
+	struct path_dir *dirs;
+	size_t num_dirs;
+	/* Maps each name to the first directory it's in, like a PATH search. */
+	GHashTable *names;
+};
+
+[[nodiscard("memory leaked")]]
+static char *get_cache_path(void)
+{
+	char *path = NULL;
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	if (cache_home != NULL) {
+		if (asprintf(&path, "%s/%s", cache_home, cache_name) < 0) {
+			return NULL;
+		}
+		return path;
+	}
+	const char *home = getenv("HOME");
+	if (home == NULL) {
+		log_error("Couldn't retrieve HOME from environment.\n");
+		return NULL;
+	}
+	if (asprintf(&path, "%s/%s/%s", home, default_cache_dir, cache_name) < 0) {
+		return NULL;
+	}
+	return path;
+}
+
+/*
+ * The cache is a sequence of NUL-terminated strings. Each directory is its
+ * path, its mtime, and its names, ended by an empty string.
+ */
+[[nodiscard("memory leaked")]]
+static char *read_cache(size_t *length)
+{
+	char *path = get_cache_path();
+	if (path == NULL) {
+		return NULL;
+	}
+	FILE *fp = fopen(path, "rb");
+	free(path);
+	if (fp == NULL) {
+		return NULL;
+	}
+	struct stat st;
+	char *buf = NULL;
+	if (fstat(fileno(fp), &st) == 0 && st.st_size > 0) {
+		buf = xmalloc(st.st_size);
+		if (fread(buf, 1, st.st_size, fp) != (size_t)st.st_size || buf[st.st_size - 1] != '\0') {
+			free(buf);
+			buf = NULL;
+		} else {
+			*length = st.st_size;
+		}
+	}
+	fclose(fp);
+	return buf;
+}
+
+/* Copy dir's names from the cache, if it has them and they're up to date. */
+static bool load_cached_dir(struct path_dir *dir, const char *cache, size_t length)
+{
+	char mtime[64];
+	snprintf(mtime, sizeof(mtime), "%lld.%09ld", (long long)dir->mtime.tv_sec, dir->mtime.tv_nsec);
+
+	const char *pos = cache;
+	const char *end = cache + length;
+	while (pos < end) {
+		const char *path = pos;
+		pos += strlen(pos) + 1;
+		if (pos >= end) {
+			return false;
+		}
+		const char *cached_mtime = pos;
+		pos += strlen(pos) + 1;
+		const char *names = pos;
+		while (pos < end && *pos) {
+			pos += strlen(pos) + 1;
+		}
+		if (pos >= end) {
+			return false;
+		}
+		pos++;
+
+		if (strcmp(path, dir->path) == 0 && strcmp(cached_mtime, mtime) == 0) {
+			dir->names_length = pos - names;
+			dir->names = xmalloc(dir->names_length);
+			memcpy(dir->names, names, dir->names_length);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void read_dir(struct path_dir *dir)
+{
+	size_t size = 4096;
+	dir->names = xmalloc(size);
+	dir->names_length = 0;
+
+	DIR *d = opendir(dir->path);
+	struct dirent *entry;
+	while (d != NULL && (entry = readdir(d)) != NULL) {
+		if (entry->d_type == DT_DIR) {
+			continue;
+		}
+		size_t len = strlen(entry->d_name) + 1;
+		/* Leave room for the final empty name. */
+		while (size - dir->names_length < len + 1) {
+			size *= 2;
+			dir->names = xrealloc(dir->names, size);
+		}
+		memcpy(&dir->names[dir->names_length], entry->d_name, len);
+		dir->names_length += len;
+	}
+	if (d != NULL) {
+		closedir(d);
+	}
+	dir->names[dir->names_length++] = '\0';
+}
+
+static void write_cache(const struct path_index *index)
+{
+	char *path = get_cache_path();
+	if (path == NULL) {
+		return;
+	}
+	char *tmp = NULL;
+	if (!mkdirp(path) || asprintf(&tmp, "%s.tmp", path) < 0) {
+		free(path);
+		return;
+	}
+
+	/* Write to a temporary file first, so readers never see half of it. */
+	FILE *fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		log_error("Failed to open PATH cache %s: %s.\n", tmp, strerror(errno));
+	} else {
+		for (size_t i = 0; i < index->num_dirs; i++) {
+			const struct path_dir *dir = &index->dirs[i];
+			fprintf(fp, "%s%c%lld.%09ld%c",
+				dir->path, '\0',
+				(long long)dir->mtime.tv_sec, dir->mtime.tv_nsec, '\0');
+			fwrite(dir->names, 1, dir->names_length, fp);
+		}
+		if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+			log_error("Failed to write PATH cache %s.\n", path);
+			unlink(tmp);
+		}
+	}
+	free(tmp);
+	free(path);
+}
+
+struct path_index *path_index_create(void)
+{
+	struct path_index *index = xcalloc(1, sizeof(*index));
+	index->names = g_hash_table_new(g_str_hash, g_str_equal);
+
+	const char *path_env = getenv("PATH");
+	if (path_env == NULL) {
+		return index;
+	}
+
+	size_t cache_length = 0;
+	char *cache = read_cache(&cache_length);
+	bool stale = false;
+
+	char *paths = xstrdup(path_env);
+	char *saveptr = NULL;
+	for (char *path = strtok_r(paths, ":", &saveptr); path; path = strtok_r(NULL, ":", &saveptr)) {
+		struct stat st;
+		if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+			continue;
+		}
+		index->dirs = xrealloc(index->dirs, (index->num_dirs + 1) * sizeof(*index->dirs));
+		struct path_dir *dir = &index->dirs[index->num_dirs++];
+		dir->path = xstrdup(path);
+		dir->mtime = st.st_mtim;
+		if (cache == NULL || !load_cached_dir(dir, cache, cache_length)) {
+			log_debug("Indexing %s.\n", path);
+			read_dir(dir);
+			stale = true;
+		}
+	}
+	free(paths);
+	free(cache);
+
+	/* Only add names once dirs has stopped moving, as they point into it. */
+	for (size_t i = 0; i < index->num_dirs; i++) {
+		struct path_dir *dir = &index->dirs[i];
+		for (char *name = dir->names; *name; name += strlen(name) + 1) {
+			if (!g_hash_table_contains(index->names, name)) {
+				g_hash_table_insert(index->names, name, dir);
+			}
+		}
+	}
+
+	if (stale) {
+		write_cache(index);
+	}
+	return index;
+}
+
+static bool is_executable(const char *dir, const char *name)
+{
+	char full_path[512];
+	snprintf(full_path, sizeof(full_path), "%s/%s", dir, name);
+	return access(full_path, X_OK) == 0;
+}
+
+bool path_index_contains(const struct path_index *index, const char *name)
+{
+	if (strchr(name, '/') == NULL) {
+		const struct path_dir *dir = g_hash_table_lookup(index->names, name);
+		if (dir == NULL) {
+			return false;
+		}
+		if (is_executable(dir->path, name)) {
+			return true;
+		}
+	}
+
+	/*
+	 * The first match isn't executable (or name is a relative path), so
+	 * fall back to searching every directory.
+	 */
+	for (size_t i = 0; i < index->num_dirs; i++) {
+		if (is_executable(index->dirs[i].path, name)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void path_index_destroy(struct path_index *index)
+{
+	g_hash_table_unref(index->names);
+	for (size_t i = 0; i < index->num_dirs; i++) {
+		free(index->dirs[i].path);
+		free(index->dirs[i].names);
+	}
+	free(index->dirs);
+	free(index);
+}
@@ -0,0 +1,25 @@
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+#include <stdbool.h>
+
+/*
+ * An index of the names in each directory of $PATH, so that checking whether
+ * lots of commands exist is a hash lookup each, rather than probing every
+ * directory for every command.
+ *
+ * Directory listings are cached in $XDG_CACHE_HOME/hypr-tofi/path, each
+ * keyed on its directory's mtime, so a directory is only read again once
+ * something's been added to or removed from it.
+ */
+struct path_index;
+
+[[nodiscard("memory leaked")]]
+struct path_index *path_index_create(void);
+
+/* Whether name is an executable somewhere in $PATH. */
+bool path_index_contains(const struct path_index *index, const char *name);
+
+void path_index_destroy(struct path_index *index);
+
+#endif /* PATH_INDEX_H */
@@ -7,10 +7,13 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include "builtin.h"
-#include "json.h"
+#include "list_stream.h"
 #include "log.h"
 #include "matching.h"
+#include "path_index.h"
 #include "plugin.h"
+#include "plugin_snapshot.h"
+#include "provider_cache.h"
 #include "string_vec.h"
 #include "xmalloc.h"
 
@@ -19,9 +22,23 @@
 
 static struct wl_list plugins;
 
+/* A global plugin's list command, running in the background. */
+struct provider_run {
+	struct wl_list link;
+	struct plugin *plugin;
+	/* Not started yet, if NULL. */
+	struct list_stream *stream;
+	/* What's been parsed so far, handed over once the command finishes. */
+	struct wl_list results;
+};
+
+static struct wl_list provider_runs;
+static size_t num_running_providers;
+
 void plugin_init(void)
 {
 	wl_list_init(&plugins);
+	wl_list_init(&provider_runs);
 }
 
 void plugin_register_builtin(struct plugin *plugin)
@@ -87,29 +104,43 @@ void plugin_apply_filter(const char *filter_string)
 
 void plugin_destroy(void)
 {
+	struct provider_run *run, *run_tmp;
+	wl_list_for_each_safe(run, run_tmp, &provider_runs, link) {
+		list_stream_destroy(run->stream);
+		wl_list_remove(&run->link);
+		free(run);
+	}
+	num_running_providers = 0;
+	
 	struct plugin *p, *tmp;
 	wl_list_for_each_safe(p, tmp, &plugins, link) {
 		if (!p->is_builtin) {
-			if (p->depends) {
-				for (size_t i = 0; i < p->depends_count; i++) {
-					free(p->depends[i]);
-				}
-				free(p->depends);
-			}
-			
-			struct plugin_action *a, *atmp;
-			wl_list_for_each_safe(a, atmp, &p->actions, link) {
-				wl_list_remove(&a->link);
-				action_def_destroy(a->action.on_select);
-				free(a);
-			}
-			
-			action_def_destroy(p->provider_action.on_select);
-			free(p);
+			plugin_free(p);
 		}
 	}
 }
 
+void plugin_free(struct plugin *plugin)
+{
+	if (plugin->depends) {
+		for (size_t i = 0; i < plugin->depends_count; i++) {
+			free(plugin->depends[i]);
+		}
+		free(plugin->depends);
+	}
+	
+	struct plugin_action *a, *atmp;
+	wl_list_for_each_safe(a, atmp, &plugin->actions, link) {
+		wl_list_remove(&a->link);
+		action_def_unref(a->action);
+		free(a);
+	}
+	
+	action_def_unref(plugin->provider_action);
+	arena_destroy(&plugin->provider_arena);
+	free(plugin);
+}
+
 static char *trim(char *str)
 {
 	while (isspace(*str)) str++;
@@ -221,26 +252,15 @@ static format_t parse_format(const char *value)
 	return FORMAT_LINES;
 }
 
+/* Built the first time a dependency is checked, while loading a directory. */
+static struct path_index *path_index;
+
 static bool check_dependency(const char *binary)
 {
-	char *path_env = getenv("PATH");
-	if (!path_env) return false;
-	
-	char *paths = xstrdup(path_env);
-	char *dir = strtok(paths, ":");
-	
-	while (dir) {
-		char full_path[512];
-		snprintf(full_path, sizeof(full_path), "%s/%s", dir, binary);
-		if (access(full_path, X_OK) == 0) {
-			free(paths);
-			return true;
-		}
-		dir = strtok(NULL, ":");
+	if (!path_index) {
+		path_index = path_index_create();
 	}
-	
-	free(paths);
-	return false;
+	return path_index_contains(path_index, binary);
 }
 
 static bool check_dependencies(struct plugin *plugin)
@@ -266,6 +286,8 @@ static struct plugin *plugin_create(void)
 	p->depends = NULL;
 	p->depends_count = 0;
 	p->populate_fn = NULL;
+	p->provider_action = action_def_create();
+	p->cache.persist = true;
 	wl_list_init(&p->actions);
 	return p;
 }
@@ -290,6 +312,11 @@ static void parse_action_fields(char *key, char *value, struct action_def *actio
 		snprintf(action->label_field, NAV_FIELD_MAX, "%s", parse_string_value(value));
 	} else if (strcmp(key, "value_field") == 0) {
 		snprintf(action->value_field, NAV_FIELD_MAX, "%s", parse_string_value(value));
+	} else if (strcmp(key, "cache_ttl") == 0) {
+		int ttl = atoi(value);
+		action->cache.ttl = ttl > 0 ? ttl : 0;
+	} else if (strcmp(key, "cache_persist") == 0) {
+		action->cache.persist = parse_bool_value(value);
 	} else if (strcmp(key, "plugin") == 0) {
 		snprintf(action->plugin_ref, NAV_NAME_MAX, "%s", parse_string_value(value));
 	} else if (strcmp(key, "eval_cmd") == 0) {
@@ -319,7 +346,7 @@ static struct plugin *parse_toml_file(const char *path)
 	
 	struct plugin *plugin = plugin_create();
 	struct plugin_action *current_action = NULL;
-	struct action_def *parent_action = NULL;
+	struct action_def *parent_action = plugin->provider_action;
 	char line[MAX_LINE_LEN];
 	
 	while (fgets(line, sizeof(line), fp)) {
@@ -329,13 +356,9 @@ static struct plugin *parse_toml_file(const char *path)
 		
 		if (strcmp(trimmed, "[[action]]") == 0) {
 			current_action = xcalloc(1, sizeof(*current_action));
-			current_action->action.selection_type = SELECTION_SELF;
-			current_action->action.execution_type = EXECUTION_EXEC;
-			current_action->action.show_input = true;
-			current_action->action.history_limit = 20;
-			current_action->action.persist_history = false;
+			current_action->action = action_def_create();
 			wl_list_insert(&plugin->actions, &current_action->link);
-			parent_action = &current_action->action;
+			parent_action = current_action->action;
 			continue;
 		}
 		
@@ -364,7 +387,7 @@ static struct plugin *parse_toml_file(const char *path)
 			} else if (strcmp(key, "display_prefix") == 0) {
 				snprintf(current_action->display_prefix, NAV_LABEL_MAX, "%s", parse_string_value(value));
 			} else {
-				parse_action_fields(key, value, &current_action->action, false);
+				parse_action_fields(key, value, current_action->action, false);
 			}
 		} else {
 			if (strcmp(key, "name") == 0) {
@@ -387,10 +410,15 @@ static struct plugin *parse_toml_file(const char *path)
 				snprintf(plugin->label_field, NAV_FIELD_MAX, "%s", parse_string_value(value));
 			} else if (strcmp(key, "value_field") == 0) {
 				snprintf(plugin->value_field, NAV_FIELD_MAX, "%s", parse_string_value(value));
+			} else if (strcmp(key, "cache_ttl") == 0) {
+				int ttl = atoi(value);
+				plugin->cache.ttl = ttl > 0 ? ttl : 0;
+			} else if (strcmp(key, "cache_key") == 0) {
+				snprintf(plugin->cache_key, NAV_NAME_MAX, "%s", parse_string_value(value));
 			} else if (strcmp(key, "template") == 0) {
-				snprintf(plugin->provider_action.template, NAV_TEMPLATE_MAX, "%s", parse_string_value(value));
+				snprintf(plugin->provider_action->template, NAV_TEMPLATE_MAX, "%s", parse_string_value(value));
 			} else if (strcmp(key, "as") == 0) {
-				snprintf(plugin->provider_action.as, NAV_KEY_MAX, "%s", parse_string_value(value));
+				snprintf(plugin->provider_action->as, NAV_KEY_MAX, "%s", parse_string_value(value));
 			}
 		}
 	}
@@ -399,10 +427,16 @@ static struct plugin *parse_toml_file(const char *path)
 	
 	if (!plugin->name[0]) {
 		log_error("Plugin missing name: %s\n", path);
-		free(plugin);
+		plugin_free(plugin);
 		return NULL;
 	}
 	
+	action_def_compile(plugin->provider_action);
+	struct plugin_action *action;
+	wl_list_for_each(action, &plugin->actions, link) {
+		action_def_compile(action->action);
+	}
+	
 	plugin->deps_satisfied = check_dependencies(plugin);
 	plugin->loaded = true;
 	
@@ -411,33 +445,59 @@ static struct plugin *parse_toml_file(const char *path)
 
 void plugin_load_directory(const char *path)
 {
-	DIR *dir = opendir(path);
-	if (!dir) {
-		log_debug("Plugin directory not found: %s\n", path);
-		return;
-	}
-	
-	struct dirent *entry;
-	while ((entry = readdir(dir)) != NULL) {
-		if (entry->d_type != DT_REG && entry->d_type != DT_LNK) continue;
-		
-		char *ext = strrchr(entry->d_name, '.');
-		if (!ext || strcmp(ext, ".toml") != 0) continue;
+	struct wl_list loaded;
+	wl_list_init(&loaded);
+	
+	if (!plugin_snapshot_load(path, &loaded)) {
+		DIR *dir = opendir(path);
+		if (!dir) {
+			log_debug("Plugin directory not found: %s\n", path);
+			return;
+		}
 		
-		char full_path[PLUGIN_PATH_MAX];
-		snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+		/* Every file counts towards the snapshot, even those that don't parse. */
+		char **files = NULL;
+		size_t num_files = 0;
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL) {
+			if (entry->d_type != DT_REG && entry->d_type != DT_LNK) continue;
+			
+			char *ext = strrchr(entry->d_name, '.');
+			if (!ext || strcmp(ext, ".toml") != 0) continue;
+			
+			files = xrealloc(files, (num_files + 1) * sizeof(*files));
+			files[num_files++] = xstrdup(entry->d_name);
+			
+			char full_path[PLUGIN_PATH_MAX];
+			snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+			
+			struct plugin *plugin = parse_toml_file(full_path);
+			if (plugin) {
+				wl_list_insert(loaded.prev, &plugin->link);
+			}
+		}
+		closedir(dir);
+		if (path_index) {
+			path_index_destroy(path_index);
+			path_index = NULL;
+		}
 		
-		struct plugin *plugin = parse_toml_file(full_path);
-		if (plugin) {
-			wl_list_insert(&plugins, &plugin->link);
-			log_debug("Loaded plugin: %s (global=%s, deps=%s)\n",
-				plugin->name,
-				plugin->global ? "yes" : "no",
-				plugin->deps_satisfied ? "ok" : "missing");
+		plugin_snapshot_save(path, &loaded, files, num_files);
+		for (size_t i = 0; i < num_files; i++) {
+			free(files[i]);
 		}
+		free(files);
 	}
 	
-	closedir(dir);
+	struct plugin *plugin, *tmp;
+	wl_list_for_each_safe(plugin, tmp, &loaded, link) {
+		wl_list_remove(&plugin->link);
+		wl_list_insert(&plugins, &plugin->link);
+		log_debug("Loaded plugin: %s (global=%s, deps=%s)\n",
+			plugin->name,
+			plugin->global ? "yes" : "no",
+			plugin->deps_satisfied ? "ok" : "missing");
+	}
 }
 
 struct plugin *plugin_get(const char *name)
@@ -461,116 +521,239 @@ size_t plugin_count(void)
 	return count;
 }
 
-static char *run_command(const char *cmd)
+/*
+ * Plugin action labels live as long as the plugin does, so results can
+ * borrow them rather than copying.
+ */
+static struct nav_result *plugin_action_result(
+	struct plugin *plugin, struct plugin_action *action, struct arena *arena)
 {
-	FILE *fp = popen(cmd, "r");
-	if (!fp) {
-		return NULL;
-	}
-	
-	char *buffer = NULL;
-	size_t buffer_size = 0;
-	size_t total = 0;
-	char chunk[1024];
-	
-	while (fgets(chunk, sizeof(chunk), fp)) {
-		size_t chunk_len = strlen(chunk);
-		char *new_buffer = realloc(buffer, buffer_size + chunk_len + 1);
-		if (!new_buffer) {
-			free(buffer);
-			pclose(fp);
-			return NULL;
-		}
-		buffer = new_buffer;
-		memcpy(buffer + total, chunk, chunk_len);
-		total += chunk_len;
-		buffer_size += chunk_len;
+	struct nav_result *res = nav_result_create(arena);
+	res->label = action->label;
+	res->value = action->label;
+	res->source_plugin = plugin->name;
+	res->action = action->action;
+	return res;
+}
+
+static struct action_def *provider_result_action(struct plugin *plugin)
+{
+	struct action_def *action = plugin->provider_action->on_select;
+	return action ? action : plugin->provider_action;
+}
+
+/* Move a provider's results over to results, tagged with the plugin. */
+static void claim_provider_results(struct plugin *plugin,
+	struct wl_list *provider_results, struct wl_list *results)
+{
+	struct nav_result *pr, *tmp;
+	wl_list_for_each_safe(pr, tmp, provider_results, link) {
+		wl_list_remove(&pr->link);
+		pr->source_plugin = plugin->name;
+		wl_list_insert(results, &pr->link);
 	}
-	
-	pclose(fp);
-	
-	if (buffer) {
-		buffer[total] = '\0';
+}
+
+static struct provider_cache_key provider_cache_key(const struct plugin *plugin)
+{
+	return (struct provider_cache_key){
+		.cmd = plugin->list_cmd,
+		.format = plugin->format,
+		.label_field = plugin->label_field,
+		.value_field = plugin->value_field,
+		.tag = plugin->cache_key,
+	};
+}
+
+static struct list_parser provider_parser(struct plugin *plugin, struct arena *arena)
+{
+	return (struct list_parser){
+		.format = plugin->format,
+		.label_field = plugin->label_field,
+		.value_field = plugin->value_field,
+		.action = provider_result_action(plugin),
+		.arena = arena,
+	};
+}
+
+/*
+ * Parse a provider's cached output into results, if there is any. This also
+ * starts a refresh if it's stale.
+ */
+static bool load_cached_provider(struct plugin *plugin, struct wl_list *results, struct arena *arena)
+{
+	struct provider_cache_key key = provider_cache_key(plugin);
+	char *output = provider_cache_lookup(&key, &plugin->cache);
+	if (!output) {
+		return false;
 	}
-	
-	return buffer;
+	struct list_parser parser = provider_parser(plugin, arena);
+	struct wl_list provider_results;
+	wl_list_init(&provider_results);
+	list_parse(&parser, output, &provider_results);
+	free(output);
+	claim_provider_results(plugin, &provider_results, results);
+	log_debug("Loaded cached results of plugin \"%s\".\n", plugin->name);
+	return true;
 }
 
-static bool extract_json_field(json_parser_t *p, const char *field_name, char *out, size_t max_len)
+static void start_providers(void)
 {
-	json_parser_t saved = *p;
-	char key[256];
-	bool has_more;
-	
-	while (json_object_next(p, key, sizeof(key), &has_more) && has_more) {
-		if (strcmp(key, field_name) == 0) {
-			bool result = json_parse_string(p, out, max_len);
-			return result;
-		} else {
-			json_skip_value(p);
+	struct provider_run *run, *tmp;
+	wl_list_for_each_safe(run, tmp, &provider_runs, link) {
+		if (num_running_providers >= PLUGIN_MAX_RUNNING_PROVIDERS) {
+			return;
+		}
+		if (run->stream) {
+			continue;
 		}
-		if (json_peek_char(p, ',')) {
-			json_expect_char(p, ',');
+		struct plugin *p = run->plugin;
+		struct list_parser parser = provider_parser(p, &p->provider_arena);
+		run->stream = list_stream_create(p->list_cmd, &parser, p->cache.ttl > 0);
+		if (!run->stream) {
+			wl_list_remove(&run->link);
+			free(run);
+			continue;
 		}
+		num_running_providers++;
+		log_debug("Started provider of plugin \"%s\".\n", run->plugin->name);
 	}
-	
-	*p = saved;
-	return false;
 }
 
-void plugin_populate_results(struct wl_list *results)
+void plugin_populate_results(struct wl_list *results, struct arena *arena)
 {
 	wl_list_init(results);
 	
+	size_t position = 0;
 	struct plugin *p;
 	wl_list_for_each(p, &plugins, link) {
 		if (!p->global || !p->enabled || !p->deps_satisfied) {
 			continue;
 		}
+		p->position = position++;
 		
 		if (p->is_builtin && p->populate_fn) {
-			p->populate_fn(p, results);
+			p->populate_fn(p, results, arena);
 			continue;
 		}
 		
-		if (p->has_provider) {
+		if (p->has_provider && builtin_is_builtin(p->list_cmd)) {
 			struct wl_list provider_results;
 			wl_list_init(&provider_results);
-			plugin_run_list_cmd(p->list_cmd, p->format, p->label_field, p->value_field,
-				p->provider_action.on_select, p->provider_action.template, p->provider_action.as,
-				&provider_results);
-			
-			struct nav_result *pr;
-			wl_list_for_each(pr, &provider_results, link) {
-				struct nav_result *copy = nav_result_create();
-				strncpy(copy->label, pr->label, NAV_LABEL_MAX - 1);
-				strncpy(copy->value, pr->value, NAV_VALUE_MAX - 1);
-				strncpy(copy->source_plugin, p->name, NAV_NAME_MAX - 1);
-				copy->action = pr->action;
-				if (pr->action.on_select) {
-					copy->action.on_select = action_def_copy(pr->action.on_select);
-				}
-				wl_list_insert(results, &copy->link);
-			}
-			nav_results_destroy(&provider_results);
+			builtin_run_list_cmd(p->list_cmd, &provider_results, &p->provider_arena);
+			claim_provider_results(p, &provider_results, results);
+		} else if (p->has_provider && p->cache.ttl > 0
+				&& load_cached_provider(p, results, &p->provider_arena)) {
+			/* Any refresh happens in the background, see plugin_provider_refreshed(). */
+		} else if (p->has_provider) {
+			struct provider_run *run = xcalloc(1, sizeof(*run));
+			run->plugin = p;
+			wl_list_init(&run->results);
+			wl_list_insert(provider_runs.prev, &run->link);
 		}
 		
 		struct plugin_action *action;
 		wl_list_for_each(action, &p->actions, link) {
-			struct nav_result *res = nav_result_create();
-			strncpy(res->label, action->label, NAV_LABEL_MAX - 1);
-			strncpy(res->value, action->label, NAV_VALUE_MAX - 1);
-			strncpy(res->source_plugin, p->name, NAV_NAME_MAX - 1);
-			res->action = action->action;
-			if (action->action.on_select) {
-				res->action.on_select = action_def_copy(action->action.on_select);
+			wl_list_insert(results, &plugin_action_result(p, action, arena)->link);
+		}
+	}
+	
+	start_providers();
+}
+
+size_t plugin_provider_pollfds(struct pollfd *fds, size_t max)
+{
+	size_t count = 0;
+	struct provider_run *run;
+	wl_list_for_each(run, &provider_runs, link) {
+		if (run->stream && count < max) {
+			fds[count].fd = run->stream->proc.fd;
+			fds[count].events = POLLIN;
+			fds[count].revents = 0;
+			count++;
+		}
+	}
+	return count;
+}
+
+bool plugin_provider_dispatch(const struct pollfd *fds, size_t count,
+	struct wl_list *results)
+{
+	bool finished = false;
+	for (size_t i = 0; i < count; i++) {
+		if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+			continue;
+		}
+		struct provider_run *run;
+		wl_list_for_each(run, &provider_runs, link) {
+			if (run->stream && run->stream->proc.fd == fds[i].fd) {
+				break;
 			}
-			wl_list_insert(results, &res->link);
+		}
+		if (&run->link == &provider_runs || !list_stream_read(run->stream, &run->results)) {
+			continue;
+		}
+		
+		num_running_providers--;
+		if (run->stream->output) {
+			struct provider_cache_key key = provider_cache_key(run->plugin);
+			provider_cache_store(&key, &run->plugin->cache, run->stream->output);
+		}
+		claim_provider_results(run->plugin, &run->results, results);
+		log_debug("Provider of plugin \"%s\" finished.\n", run->plugin->name);
+		
+		list_stream_destroy(run->stream);
+		wl_list_remove(&run->link);
+		free(run);
+		finished = true;
+	}
+	
+	start_providers();
+	return finished;
+}
+
+struct plugin *plugin_provider_refreshed(const struct provider_cache_key *key,
+	struct wl_list *results, struct arena *retired)
+{
+	struct plugin *p;
+	wl_list_for_each(p, &plugins, link) {
+		if (!p->global || !p->enabled || !p->deps_satisfied
+				|| !p->has_provider || p->cache.ttl == 0) {
+			continue;
+		}
+		struct provider_cache_key plugin_key = provider_cache_key(p);
+		if (!provider_cache_key_equal(key, &plugin_key)) {
+			continue;
+		}
+		wl_list_init(results);
+		struct arena old = p->provider_arena;
+		p->provider_arena = (struct arena){0};
+		if (!load_cached_provider(p, results, &p->provider_arena)) {
+			arena_destroy(&p->provider_arena);
+			p->provider_arena = old;
+			return NULL;
+		}
+		*retired = old;
+		return p;
+	}
+	return NULL;
+}
+
+bool plugin_provided(const struct plugin *plugin, const struct nav_result *result)
+{
+	if (!plugin->has_provider) {
+		return false;
+	}
+	struct plugin_action *action;
+	wl_list_for_each(action, &plugin->actions, link) {
+		if (result->action == action->action) {
+			return false;
 		}
 	}
+	return true;
 }
 
-void plugin_populate_plugin_actions(struct plugin *plugin, struct wl_list *results)
+void plugin_populate_plugin_actions(struct plugin *plugin, struct wl_list *results, struct arena *arena)
 {
 	wl_list_init(results);
 	
@@ -580,163 +763,46 @@ void plugin_populate_plugin_actions(struct plugin *plugin, struct wl_list *resul
 	
 	struct plugin_action *action;
 	wl_list_for_each(action, &plugin->actions, link) {
-		struct nav_result *res = nav_result_create();
-		strncpy(res->label, action->label, NAV_LABEL_MAX - 1);
-		strncpy(res->value, action->label, NAV_VALUE_MAX - 1);
-		strncpy(res->source_plugin, plugin->name, NAV_NAME_MAX - 1);
-		res->action = action->action;
-		if (action->action.on_select) {
-			res->action.on_select = action_def_copy(action->action.on_select);
-		}
-		wl_list_insert(results, &res->link);
+		wl_list_insert(results, &plugin_action_result(plugin, action, arena)->link);
 	}
 }
 
-void plugin_run_list_cmd(const char *list_cmd, format_t format,
+struct list_stream *plugin_run_list_cmd(const char *list_cmd, format_t format,
 	const char *label_field, const char *value_field,
-	struct action_def *on_select, const char *template, const char *as,
-	struct wl_list *results)
+	struct action_def *action, const struct cache_policy *cache,
+	struct wl_list *results, struct arena *arena)
 {
 	wl_list_init(results);
 	
 	if (builtin_is_builtin(list_cmd)) {
-		builtin_run_list_cmd(list_cmd, results);
-		return;
-	}
-	
-	char *output = run_command(list_cmd);
-	if (!output) {
-		return;
+		builtin_run_list_cmd(list_cmd, results, arena);
+		return NULL;
 	}
 	
-	if (format == FORMAT_LINES) {
-		char *line = strtok(output, "\n");
-		while (line) {
-			char *trimmed = trim(line);
-			if (*trimmed) {
-				struct nav_result *res = nav_result_create();
-				strncpy(res->label, trimmed, NAV_LABEL_MAX - 1);
-				strncpy(res->value, trimmed, NAV_VALUE_MAX - 1);
-				res->action.selection_type = SELECTION_SELF;
-				res->action.execution_type = EXECUTION_EXEC;
-				
-				if (on_select) {
-					res->action = *on_select;
-					if (on_select->on_select) {
-						res->action.on_select = action_def_copy(on_select->on_select);
-					}
-				} else {
-					if (template) {
-						strncpy(res->action.template, template, NAV_TEMPLATE_MAX - 1);
-					}
-					if (as) {
-						strncpy(res->action.as, as, NAV_KEY_MAX - 1);
-					}
-				}
-				
-				wl_list_insert(results, &res->link);
-			}
-			line = strtok(NULL, "\n");
-		}
-	} else if (format == FORMAT_JSON) {
-		json_parser_t parser;
-		json_parser_init(&parser, output);
-		
-		if (json_peek_char(&parser, '[')) {
-			if (!json_array_begin(&parser)) {
-				free(output);
-				return;
-			}
-			
-			bool has_more;
-			while (json_array_next(&parser, &has_more) && has_more) {
-				if (!json_object_begin(&parser)) break;
-				
-				char label_val[NAV_LABEL_MAX] = "";
-				char value_val[NAV_LABEL_MAX] = "";
-				
-				json_parser_t obj_parser = parser;
-				extract_json_field(&obj_parser, label_field, label_val, sizeof(label_val));
-				obj_parser = parser;
-				extract_json_field(&obj_parser, value_field, value_val, sizeof(value_val));
-				
-				json_skip_value(&parser);
-				json_object_end(&parser);
-				
-				if (json_peek_char(&parser, ',')) {
-					json_expect_char(&parser, ',');
-				}
-				
-				if (label_val[0]) {
-					struct nav_result *res = nav_result_create();
-					strncpy(res->label, label_val, NAV_LABEL_MAX - 1);
-					strncpy(res->value, value_val[0] ? value_val : label_val, NAV_VALUE_MAX - 1);
-					res->action.selection_type = SELECTION_SELF;
-					res->action.execution_type = EXECUTION_EXEC;
-					
-					if (on_select) {
-						res->action = *on_select;
-						if (on_select->on_select) {
-							res->action.on_select = action_def_copy(on_select->on_select);
-						}
-					} else {
-						if (template) {
-							strncpy(res->action.template, template, NAV_TEMPLATE_MAX - 1);
-						}
-						if (as) {
-							strncpy(res->action.as, as, NAV_KEY_MAX - 1);
-						}
-					}
-					
-					wl_list_insert(results, &res->link);
-				}
-			}
-			
-			json_array_end(&parser);
-		} else {
-			while (*parser.pos) {
-				json_skip_ws(&parser);
-				if (!*parser.pos) break;
-				
-				if (!json_object_begin(&parser)) break;
-				
-				char label_val[NAV_LABEL_MAX] = "";
-				char value_val[NAV_LABEL_MAX] = "";
-				
-				json_parser_t obj_parser = parser;
-				extract_json_field(&obj_parser, label_field, label_val, sizeof(label_val));
-				obj_parser = parser;
-				extract_json_field(&obj_parser, value_field, value_val, sizeof(value_val));
-				
-				json_skip_value(&parser);
-				json_object_end(&parser);
-				
-				if (label_val[0]) {
-					struct nav_result *res = nav_result_create();
-					strncpy(res->label, label_val, NAV_LABEL_MAX - 1);
-					strncpy(res->value, value_val[0] ? value_val : label_val, NAV_VALUE_MAX - 1);
-					res->action.selection_type = SELECTION_SELF;
-					res->action.execution_type = EXECUTION_EXEC;
-					
-					if (on_select) {
-						res->action = *on_select;
-						if (on_select->on_select) {
-							res->action.on_select = action_def_copy(on_select->on_select);
-						}
-					} else {
-						if (template) {
-							strncpy(res->action.template, template, NAV_TEMPLATE_MAX - 1);
-						}
-						if (as) {
-							strncpy(res->action.as, as, NAV_KEY_MAX - 1);
-						}
-					}
-					
-					wl_list_insert(results, &res->link);
-				}
-			}
+	struct list_parser parser = {
+		.format = format,
+		.label_field = label_field ? label_field : "",
+		.value_field = value_field ? value_field : "",
+		.action = action,
+		.arena = arena,
+	};
+	bool use_cache = cache && cache->ttl > 0;
+	
+	if (use_cache) {
+		struct provider_cache_key key = {
+			.cmd = list_cmd,
+			.format = format,
+			.label_field = parser.label_field,
+			.value_field = parser.value_field,
+			.tag = "",
+		};
+		char *output = provider_cache_lookup(&key, cache);
+		if (output) {
+			list_parse(&parser, output, results);
+			free(output);
+			return NULL;
 		}
 	}
 	
-	free(output);
+	return list_stream_create(list_cmd, &parser, use_cache);
 }
@@ -1,25 +1,36 @@
 #ifndef PLUGIN_H
 #define PLUGIN_H
 
+#include <poll.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <wayland-client.h>
+#include "arena.h"
+#include "list_stream.h"
 #include "nav.h"
 #include "string_vec.h"
 
 #define PLUGIN_NAME_MAX 64
 #define PLUGIN_PATH_MAX 256
 
+/*
+ * How many global providers may run at once, and so how many fds we need
+ * polled. Any more wait for one of these to finish, rather than forking
+ * every provider at once while the window is trying to appear.
+ */
+#define PLUGIN_MAX_RUNNING_PROVIDERS 16
+
 struct plugin;
+struct provider_cache_key;
 struct wl_list;
 
-typedef void (*plugin_populate_fn)(struct plugin *plugin, struct wl_list *results);
+typedef void (*plugin_populate_fn)(struct plugin *plugin, struct wl_list *results, struct arena *arena);
 
 struct plugin_action {
 	struct wl_list link;
 	char label[NAV_LABEL_MAX];
 	char display_prefix[NAV_LABEL_MAX];
-	struct action_def action;
+	struct action_def *action;
 };
 
 struct plugin {
@@ -41,10 +52,31 @@ struct plugin {
 	format_t format;
 	char label_field[NAV_FIELD_MAX];
 	char value_field[NAV_FIELD_MAX];
-	struct action_def provider_action;
+	struct action_def *provider_action;
+	
+	/*
+	 * With a cache_ttl, the provider's output is kept on disk, shown
+	 * straight away at startup, and refreshed in the background once it's
+	 * older than that. Changing cache_key invalidates it.
+	 */
+	struct cache_policy cache;
+	char cache_key[NAV_NAME_MAX];
+	/*
+	 * The provider's results, and anything that lives as long as they do,
+	 * are allocated from here rather than the caller's arena, so that
+	 * replacing them with refreshed ones can free the old ones.
+	 */
+	struct arena provider_arena;
 	
 	struct wl_list actions;
 	
+	/*
+	 * The plugin's place in the order plugin_populate_results() visited
+	 * global plugins in, so results that arrive later can be put with the
+	 * rest of the plugin's.
+	 */
+	size_t position;
+	
 	bool loaded;
 	bool deps_satisfied;
 };
@@ -52,6 +84,9 @@ struct plugin {
 void plugin_init(void);
 void plugin_destroy(void);
 
+/* Free a plugin loaded from a file, which mustn't be in the plugin list. */
+void plugin_free(struct plugin *plugin);
+
 void plugin_register_builtin(struct plugin *plugin);
 void plugin_load_directory(const char *path);
 struct plugin *plugin_get(const char *name);
@@ -61,11 +96,58 @@ void plugin_set_all_enabled(bool enabled);
 void plugin_set_enabled(const char *name, bool enabled);
 void plugin_apply_filter(const char *filter_string);
 
-void plugin_populate_results(struct wl_list *results);
-void plugin_populate_plugin_actions(struct plugin *plugin, struct wl_list *results);
-void plugin_run_list_cmd(const char *list_cmd, format_t format,
-	const char *label_field, const char *value_field,
-	struct action_def *on_select, const char *template, const char *as,
+/*
+ * These allocate results from arena (apart from those of global providers,
+ * see plugin.provider_arena), and the results borrow their actions, so the
+ * arena mustn't outlive the plugins (or, for plugin_run_list_cmd(), the
+ * action every result is given).
+ *
+ * plugin_populate_results() prepends each global plugin's results in turn,
+ * so they're grouped by plugin, the last one visited first. It doesn't wait
+ * for the list commands of global providers. They're started in the
+ * background (at most PLUGIN_MAX_RUNNING_PROVIDERS at a time), and their
+ * results come later through plugin_provider_dispatch(), for the caller to
+ * put in their plugin's place.
+ */
+void plugin_populate_results(struct wl_list *results, struct arena *arena);
+
+/* Fill in up to max pollfds for running providers, returning how many. */
+size_t plugin_provider_pollfds(struct pollfd *fds, size_t max);
+
+/*
+ * Read from any providers that are ready, and add the results of each one
+ * that's finished to results. Returns whether any have finished.
+ */
+bool plugin_provider_dispatch(const struct pollfd *fds, size_t count,
 	struct wl_list *results);
 
+/*
+ * If key is the cached output of a global provider, which has just been
+ * refreshed, parse the new output into results and return the plugin. Its
+ * old results are for the caller to replace, and the arena they're in is
+ * moved to retired, for the caller to destroy once nothing refers to them.
+ */
+struct plugin *plugin_provider_refreshed(const struct provider_cache_key *key,
+	struct wl_list *results, struct arena *retired);
+
+/* Whether result came from plugin's provider, rather than being an action. */
+bool plugin_provided(const struct plugin *plugin, const struct nav_result *result);
+
+void plugin_populate_plugin_actions(struct plugin *plugin, struct wl_list *results, struct arena *arena);
+
+/*
+ * Fill results from list_cmd. Builtin lists, and output cached under cache
+ * (if it isn't NULL, see provider_cache.h), are parsed straight away and NULL
+ * is returned. Otherwise the command is started, and the returned stream
+ * delivers its results as they arrive. If caching is on, the stream keeps its
+ * whole output, for the caller to store once it's finished.
+ *
+ * The field strings must outlive the stream.
+ */
+[[nodiscard("memory leaked")]]
+struct list_stream *plugin_run_list_cmd(const char *list_cmd, format_t format,
+	const char *label_field, const char *value_field,
+	struct action_def *action, const struct cache_policy *cache,
+	struct wl_list *results, struct arena *arena);
+
 #endif
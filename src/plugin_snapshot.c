@@ -0,0 +1,501 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log.h"
+#include "mkdirp.h"
+#include "nav.h"
+#include "plugin.h"
+#include "plugin_snapshot.h"
+#include "xmalloc.h"
+
+/* Bump SNAPSHOT_VERSION whenever the format below changes. */
+static const char snapshot_magic[8] = "htplugs";
+#define SNAPSHOT_VERSION 1
+
+static const char *default_cache_dir = ".cache";
+static const char *snapshot_name = "hypr-tofi/plugins";
+
+/*
+ * The snapshot is a flat sequence of little records, in the order they're
+ * written below. Integers are stored in native byte order, as the snapshot
+ * never leaves the machine, and strings are a 32-bit length followed by the
+ * bytes, without a terminator.
+ */
+struct writer {
+	char *buf;
+	size_t length;
+	size_t size;
+};
+
+struct reader {
+	const char *pos;
+	const char *end;
+	bool ok;
+};
+
+static void put(struct writer *w, const void *data, size_t length)
+{
+	if (w->size - w->length < length) {
+		while (w->size - w->length < length) {
+			w->size = w->size ? w->size * 2 : 4096;
+		}
+		w->buf = xrealloc(w->buf, w->size);
+	}
+	memcpy(&w->buf[w->length], data, length);
+	w->length += length;
+}
+
+static void put_u32(struct writer *w, uint32_t value)
+{
+	put(w, &value, sizeof(value));
+}
+
+static void put_i64(struct writer *w, int64_t value)
+{
+	put(w, &value, sizeof(value));
+}
+
+static void put_bool(struct writer *w, bool value)
+{
+	uint8_t byte = value;
+	put(w, &byte, sizeof(byte));
+}
+
+static void put_str(struct writer *w, const char *str)
+{
+	size_t length = strlen(str);
+	put_u32(w, length);
+	put(w, str, length);
+}
+
+static void get(struct reader *r, void *out, size_t length)
+{
+	if (!r->ok || (size_t)(r->end - r->pos) < length) {
+		r->ok = false;
+		memset(out, 0, length);
+		return;
+	}
+	memcpy(out, r->pos, length);
+	r->pos += length;
+}
+
+static uint32_t get_u32(struct reader *r)
+{
+	uint32_t value;
+	get(r, &value, sizeof(value));
+	return value;
+}
+
+static int64_t get_i64(struct reader *r)
+{
+	int64_t value;
+	get(r, &value, sizeof(value));
+	return value;
+}
+
+static bool get_bool(struct reader *r)
+{
+	uint8_t byte;
+	get(r, &byte, sizeof(byte));
+	return byte;
+}
+
+/* Return a string in place, setting *length, or NULL if there isn't one. */
+static const char *get_bytes(struct reader *r, uint32_t *length)
+{
+	*length = get_u32(r);
+	if (!r->ok || (size_t)(r->end - r->pos) < *length) {
+		r->ok = false;
+		return NULL;
+	}
+	const char *bytes = r->pos;
+	r->pos += *length;
+	return bytes;
+}
+
+/* Read a string into a fixed-size field, as the parser would have. */
+static void get_str(struct reader *r, char *out, size_t size)
+{
+	uint32_t length;
+	const char *bytes = get_bytes(r, &length);
+	if (bytes == NULL) {
+		out[0] = '\0';
+		return;
+	}
+	snprintf(out, size, "%.*s", (int)length, bytes);
+}
+
+static bool match_str(struct reader *r, const char *str)
+{
+	uint32_t length;
+	const char *bytes = get_bytes(r, &length);
+	return bytes != NULL && length == strlen(str) && memcmp(bytes, str, length) == 0;
+}
+
+/*
+ * Anything that stat()s differently invalidates the snapshot. Something
+ * that's missing is recorded as all zeroes.
+ */
+static void put_stat(struct writer *w, const char *path)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		memset(&st, 0, sizeof(st));
+	}
+	put_i64(w, st.st_mtim.tv_sec);
+	put_i64(w, st.st_mtim.tv_nsec);
+	put_i64(w, st.st_size);
+}
+
+static bool match_stat(struct reader *r, const char *path)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		memset(&st, 0, sizeof(st));
+	}
+	bool mtime_sec = get_i64(r) == st.st_mtim.tv_sec;
+	bool mtime_nsec = get_i64(r) == st.st_mtim.tv_nsec;
+	bool size = get_i64(r) == st.st_size;
+	return r->ok && mtime_sec && mtime_nsec && size;
+}
+
+/* Dependencies are looked up in each directory of $PATH, so watch those too. */
+static void put_path(struct writer *w)
+{
+	const char *path_env = getenv("PATH");
+	if (path_env == NULL) {
+		path_env = "";
+	}
+	put_str(w, path_env);
+
+	char *paths = xstrdup(path_env);
+	char *saveptr = NULL;
+	for (char *dir = strtok_r(paths, ":", &saveptr); dir; dir = strtok_r(NULL, ":", &saveptr)) {
+		put_stat(w, dir);
+	}
+	free(paths);
+}
+
+static bool match_path(struct reader *r)
+{
+	const char *path_env = getenv("PATH");
+	if (path_env == NULL) {
+		path_env = "";
+	}
+	if (!match_str(r, path_env)) {
+		return false;
+	}
+
+	char *paths = xstrdup(path_env);
+	char *saveptr = NULL;
+	bool match = true;
+	for (char *dir = strtok_r(paths, ":", &saveptr); dir && match; dir = strtok_r(NULL, ":", &saveptr)) {
+		match = match_stat(r, dir);
+	}
+	free(paths);
+	return match;
+}
+
+static void put_action(struct writer *w, const struct action_def *action)
+{
+	put_u32(w, action->selection_type);
+	put_u32(w, action->execution_type);
+	put_str(w, action->as);
+	put_str(w, action->template);
+	put_str(w, action->prompt);
+	put_str(w, action->list_cmd);
+	put_u32(w, action->format);
+	put_str(w, action->label_field);
+	put_str(w, action->value_field);
+	put_u32(w, action->cache.ttl);
+	put_bool(w, action->cache.persist);
+	put_str(w, action->plugin_ref);
+	put_str(w, action->eval_cmd);
+	put_str(w, action->display_input);
+	put_str(w, action->display_result);
+	put_bool(w, action->show_input);
+	put_u32(w, action->history_limit);
+	put_bool(w, action->persist_history);
+	put_str(w, action->history_name);
+	put_bool(w, action->on_select != NULL);
+	if (action->on_select) {
+		put_action(w, action->on_select);
+	}
+}
+
+/* Templates aren't stored compiled, so the caller must compile the result. */
+[[nodiscard("memory leaked")]]
+static struct action_def *get_action(struct reader *r)
+{
+	struct action_def *action = action_def_create();
+	action->selection_type = get_u32(r);
+	action->execution_type = get_u32(r);
+	get_str(r, action->as, sizeof(action->as));
+	get_str(r, action->template, sizeof(action->template));
+	get_str(r, action->prompt, sizeof(action->prompt));
+	get_str(r, action->list_cmd, sizeof(action->list_cmd));
+	action->format = get_u32(r);
+	get_str(r, action->label_field, sizeof(action->label_field));
+	get_str(r, action->value_field, sizeof(action->value_field));
+	action->cache.ttl = get_u32(r);
+	action->cache.persist = get_bool(r);
+	get_str(r, action->plugin_ref, sizeof(action->plugin_ref));
+	get_str(r, action->eval_cmd, sizeof(action->eval_cmd));
+	get_str(r, action->display_input, sizeof(action->display_input));
+	get_str(r, action->display_result, sizeof(action->display_result));
+	action->show_input = get_bool(r);
+	action->history_limit = (int32_t)get_u32(r);
+	action->persist_history = get_bool(r);
+	get_str(r, action->history_name, sizeof(action->history_name));
+	if (get_bool(r) && r->ok) {
+		action->on_select = get_action(r);
+	}
+	return action;
+}
+
+static void put_plugin(struct writer *w, const struct plugin *plugin)
+{
+	put_str(w, plugin->name);
+	put_str(w, plugin->display_prefix);
+	put_str(w, plugin->context_name);
+	put_bool(w, plugin->global);
+	put_u32(w, plugin->depends_count);
+	for (size_t i = 0; i < plugin->depends_count; i++) {
+		put_str(w, plugin->depends[i]);
+	}
+	put_bool(w, plugin->deps_satisfied);
+	put_bool(w, plugin->has_provider);
+	put_str(w, plugin->list_cmd);
+	put_u32(w, plugin->format);
+	put_str(w, plugin->label_field);
+	put_str(w, plugin->value_field);
+	put_u32(w, plugin->cache.ttl);
+	put_bool(w, plugin->cache.persist);
+	put_str(w, plugin->cache_key);
+	put_action(w, plugin->provider_action);
+
+	put_u32(w, wl_list_length(&plugin->actions));
+	struct plugin_action *action;
+	wl_list_for_each(action, &plugin->actions, link) {
+		put_str(w, action->label);
+		put_str(w, action->display_prefix);
+		put_action(w, action->action);
+	}
+}
+
+[[nodiscard("memory leaked")]]
+static struct plugin *get_plugin(struct reader *r)
+{
+	struct plugin *plugin = xcalloc(1, sizeof(*plugin));
+	wl_list_init(&plugin->actions);
+	plugin->enabled = true;
+	plugin->loaded = true;
+
+	get_str(r, plugin->name, sizeof(plugin->name));
+	get_str(r, plugin->display_prefix, sizeof(plugin->display_prefix));
+	get_str(r, plugin->context_name, sizeof(plugin->context_name));
+	plugin->global = get_bool(r);
+	uint32_t depends_count = get_u32(r);
+	if (r->ok && depends_count > 0) {
+		/* Don't trust the count with an allocation before checking it's there. */
+		if ((size_t)(r->end - r->pos) < depends_count * sizeof(uint32_t)) {
+			r->ok = false;
+		} else {
+			plugin->depends = xcalloc(depends_count, sizeof(*plugin->depends));
+			for (; plugin->depends_count < depends_count; plugin->depends_count++) {
+				uint32_t length;
+				const char *bytes = get_bytes(r, &length);
+				char *depend = xmalloc(length + 1);
+				if (bytes != NULL) {
+					memcpy(depend, bytes, length);
+				}
+				depend[bytes ? length : 0] = '\0';
+				plugin->depends[plugin->depends_count] = depend;
+			}
+		}
+	}
+	plugin->deps_satisfied = get_bool(r);
+	plugin->has_provider = get_bool(r);
+	get_str(r, plugin->list_cmd, sizeof(plugin->list_cmd));
+	plugin->format = get_u32(r);
+	get_str(r, plugin->label_field, sizeof(plugin->label_field));
+	get_str(r, plugin->value_field, sizeof(plugin->value_field));
+	plugin->cache.ttl = get_u32(r);
+	plugin->cache.persist = get_bool(r);
+	get_str(r, plugin->cache_key, sizeof(plugin->cache_key));
+	plugin->provider_action = get_action(r);
+	action_def_compile(plugin->provider_action);
+
+	uint32_t num_actions = get_u32(r);
+	for (uint32_t i = 0; i < num_actions && r->ok; i++) {
+		struct plugin_action *action = xcalloc(1, sizeof(*action));
+		get_str(r, action->label, sizeof(action->label));
+		get_str(r, action->display_prefix, sizeof(action->display_prefix));
+		action->action = get_action(r);
+		action_def_compile(action->action);
+		wl_list_insert(plugin->actions.prev, &action->link);
+	}
+	return plugin;
+}
+
+[[nodiscard("memory leaked")]]
+static char *get_snapshot_path(void)
+{
+	char *path = NULL;
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	if (cache_home != NULL) {
+		if (asprintf(&path, "%s/%s", cache_home, snapshot_name) < 0) {
+			return NULL;
+		}
+		return path;
+	}
+	const char *home = getenv("HOME");
+	if (home == NULL) {
+		log_error("Couldn't retrieve HOME from environment.\n");
+		return NULL;
+	}
+	if (asprintf(&path, "%s/%s/%s", home, default_cache_dir, snapshot_name) < 0) {
+		return NULL;
+	}
+	return path;
+}
+
+/* Check the snapshot's key against the world as it is now. */
+static bool match_key(struct reader *r, const char *dir)
+{
+	char magic[sizeof(snapshot_magic)];
+	get(r, magic, sizeof(magic));
+	if (memcmp(magic, snapshot_magic, sizeof(magic)) != 0
+			|| get_u32(r) != SNAPSHOT_VERSION
+			|| !match_str(r, dir)
+			|| !match_stat(r, dir)
+			|| !match_path(r)) {
+		return false;
+	}
+
+	uint32_t num_files = get_u32(r);
+	for (uint32_t i = 0; i < num_files && r->ok; i++) {
+		char name[PLUGIN_PATH_MAX];
+		get_str(r, name, sizeof(name));
+		char full_path[PLUGIN_PATH_MAX];
+		snprintf(full_path, sizeof(full_path), "%s/%s", dir, name);
+		if (!match_stat(r, full_path)) {
+			return false;
+		}
+	}
+	return r->ok;
+}
+
+bool plugin_snapshot_load(const char *dir, struct wl_list *plugins)
+{
+	char *path = get_snapshot_path();
+	if (path == NULL) {
+		return false;
+	}
+	FILE *fp = fopen(path, "rb");
+	free(path);
+	if (fp == NULL) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fileno(fp), &st) != 0 || st.st_size == 0) {
+		fclose(fp);
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	fclose(fp);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+
+	struct reader r = {
+		.pos = map,
+		.end = (const char *)map + st.st_size,
+		.ok = true,
+	};
+	if (!match_key(&r, dir)) {
+		log_debug("Plugin snapshot is out of date.\n");
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	struct wl_list loaded;
+	wl_list_init(&loaded);
+	uint32_t num_plugins = get_u32(&r);
+	for (uint32_t i = 0; i < num_plugins && r.ok; i++) {
+		wl_list_insert(loaded.prev, &get_plugin(&r)->link);
+	}
+	munmap(map, st.st_size);
+
+	if (!r.ok || r.pos != r.end) {
+		log_error("Plugin snapshot is corrupt, ignoring it.\n");
+		struct plugin *plugin;
+		struct plugin *tmp;
+		wl_list_for_each_safe(plugin, tmp, &loaded, link) {
+			wl_list_remove(&plugin->link);
+			plugin_free(plugin);
+		}
+		return false;
+	}
+
+	log_debug("Loaded %u plugins from snapshot.\n", num_plugins);
+	wl_list_insert_list(plugins->prev, &loaded);
+	return true;
+}
+
+void plugin_snapshot_save(
+		const char *dir,
+		const struct wl_list *plugins,
+		char *const *files,
+		size_t num_files)
+{
+	char *path = get_snapshot_path();
+	if (path == NULL) {
+		return;
+	}
+
+	struct writer w = { 0 };
+	put(&w, snapshot_magic, sizeof(snapshot_magic));
+	put_u32(&w, SNAPSHOT_VERSION);
+	put_str(&w, dir);
+	put_stat(&w, dir);
+	put_path(&w);
+	put_u32(&w, num_files);
+	for (size_t i = 0; i < num_files; i++) {
+		char full_path[PLUGIN_PATH_MAX];
+		snprintf(full_path, sizeof(full_path), "%s/%s", dir, files[i]);
+		put_str(&w, files[i]);
+		put_stat(&w, full_path);
+	}
+	put_u32(&w, wl_list_length(plugins));
+	struct plugin *plugin;
+	wl_list_for_each(plugin, plugins, link) {
+		put_plugin(&w, plugin);
+	}
+
+	/* Write to a temporary file first, so readers never see half of it. */
+	char *tmp = NULL;
+	if (!mkdirp(path) || asprintf(&tmp, "%s.tmp", path) < 0) {
+		free(w.buf);
+		free(path);
+		return;
+	}
+	FILE *fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		log_error("Failed to open plugin snapshot %s: %s.\n", tmp, strerror(errno));
+	} else {
+		bool written = fwrite(w.buf, 1, w.length, fp) == w.length;
+		if (fclose(fp) != 0 || !written || rename(tmp, path) != 0) {
+			log_error("Failed to write plugin snapshot %s.\n", path);
+			unlink(tmp);
+		}
+	}
+	free(tmp);
+	free(w.buf);
+	free(path);
+}
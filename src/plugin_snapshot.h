@@ -0,0 +1,37 @@
+#ifndef PLUGIN_SNAPSHOT_H
+#define PLUGIN_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <wayland-client.h>
+
+/*
+ * A binary snapshot of the plugins parsed from a directory, so that a launch
+ * where nothing has changed can skip parsing every TOML file and probing
+ * $PATH for every dependency.
+ *
+ * The snapshot lives in $XDG_CACHE_HOME/hypr-tofi/plugins, and is only used
+ * if the directory's mtime, the mtime and size of every plugin file, $PATH
+ * and the mtime of every directory in it all match what they were when it
+ * was saved. Anything else means plugins (or their dependencies) may have
+ * changed, and the directory is parsed as normal.
+ */
+
+/*
+ * Append the plugins from the snapshot of dir to plugins, in the order they
+ * were saved, returning false (and adding nothing) if it's missing or out of
+ * date.
+ */
+bool plugin_snapshot_load(const char *dir, struct wl_list *plugins);
+
+/*
+ * Save plugins, freshly parsed from the files in dir (including any that
+ * failed to parse), as its snapshot.
+ */
+void plugin_snapshot_save(
+		const char *dir,
+		const struct wl_list *plugins,
+		char *const *files,
+		size_t num_files);
+
+#endif /* PLUGIN_SNAPSHOT_H */
@@ -0,0 +1,375 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "log.h"
+#include "mkdirp.h"
+#include "nelem.h"
+#include "provider_cache.h"
+#include "subprocess.h"
+#include "xmalloc.h"
+
+static const char *default_cache_dir = ".cache";
+static const char *cache_dirname = "hypr-tofi/lists";
+
+struct cache_entry {
+	struct wl_list link;
+
+	/*
+	 * The key, serialised as its format followed by each string, all
+	 * NUL-terminated. This is also the header of the entry's file on
+	 * disk, so a (very unlikely) hash collision isn't mistaken for a hit.
+	 */
+	char *blob;
+	size_t blob_length;
+	struct provider_cache_key key;
+
+	char *output;
+	time_t fetched;
+	bool persist;
+
+	/* The last time we started a refresh, so a failing one isn't retried in a loop. */
+	time_t attempted;
+	/* Set when a refresh is due, but too many are already running. */
+	bool queued;
+	uint32_t ttl;
+
+	/* A running refresh, if proc.fd isn't -1. */
+	struct subprocess proc;
+};
+
+static struct wl_list entries = {
+	.prev = &entries,
+	.next = &entries,
+};
+
+static size_t num_refreshes;
+
+static char *key_blob(const struct provider_cache_key *key, size_t *length)
+{
+	char format[16];
+	snprintf(format, sizeof(format), "%d", (int)key->format);
+	const char *parts[] = {format, key->label_field, key->value_field, key->tag, key->cmd};
+
+	size_t len = 0;
+	for (size_t i = 0; i < N_ELEM(parts); i++) {
+		len += strlen(parts[i]) + 1;
+	}
+	char *blob = xmalloc(len);
+	char *cursor = blob;
+	for (size_t i = 0; i < N_ELEM(parts); i++) {
+		size_t n = strlen(parts[i]) + 1;
+		memcpy(cursor, parts[i], n);
+		cursor += n;
+	}
+	*length = len;
+	return blob;
+}
+
+bool provider_cache_key_equal(const struct provider_cache_key *a, const struct provider_cache_key *b)
+{
+	return a->format == b->format
+		&& strcmp(a->cmd, b->cmd) == 0
+		&& strcmp(a->label_field, b->label_field) == 0
+		&& strcmp(a->value_field, b->value_field) == 0
+		&& strcmp(a->tag, b->tag) == 0;
+}
+
+[[nodiscard("memory leaked")]]
+static char *get_cache_path(const struct cache_entry *entry)
+{
+	/* FNV-1a, which is plenty to name a handful of files. */
+	uint64_t hash = 14695981039346656037u;
+	for (size_t i = 0; i < entry->blob_length; i++) {
+		hash ^= (unsigned char)entry->blob[i];
+		hash *= 1099511628211u;
+	}
+
+	char *path = NULL;
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	if (cache_home != NULL) {
+		if (asprintf(&path, "%s/%s/%016llx", cache_home, cache_dirname, (unsigned long long)hash) < 0) {
+			return NULL;
+		}
+		return path;
+	}
+	const char *home = getenv("HOME");
+	if (home == NULL) {
+		log_error("Couldn't retrieve HOME from environment.\n");
+		return NULL;
+	}
+	if (asprintf(&path, "%s/%s/%s/%016llx", home, default_cache_dir, cache_dirname, (unsigned long long)hash) < 0) {
+		return NULL;
+	}
+	return path;
+}
+
+static void load_entry(struct cache_entry *entry)
+{
+	char *path = get_cache_path(entry);
+	if (path == NULL) {
+		return;
+	}
+	FILE *fp = fopen(path, "rb");
+	free(path);
+	if (fp == NULL) {
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fileno(fp), &st) != 0 || (size_t)st.st_size < entry->blob_length) {
+		fclose(fp);
+		return;
+	}
+	size_t size = st.st_size;
+	char *contents = xmalloc(size + 1);
+	if (fread(contents, 1, size, fp) != size
+			|| memcmp(contents, entry->blob, entry->blob_length) != 0) {
+		free(contents);
+		fclose(fp);
+		return;
+	}
+	fclose(fp);
+	contents[size] = '\0';
+
+	size_t output_length = size - entry->blob_length;
+	entry->output = xmalloc(output_length + 1);
+	memcpy(entry->output, contents + entry->blob_length, output_length + 1);
+	entry->fetched = st.st_mtime;
+	free(contents);
+	log_debug("Loaded cached output of \"%s\".\n", entry->key.cmd);
+}
+
+static void save_entry(const struct cache_entry *entry)
+{
+	char *path = get_cache_path(entry);
+	if (path == NULL) {
+		return;
+	}
+
+	/* This creates every directory leading up to the file. */
+	if (!mkdirp(path)) {
+		free(path);
+		return;
+	}
+
+	/* Write to a temporary file first, so readers never see half of it. */
+	char *tmp = NULL;
+	if (asprintf(&tmp, "%s.tmp", path) < 0) {
+		free(path);
+		return;
+	}
+	FILE *fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		log_error("Failed to open cache file %s: %s.\n", tmp, strerror(errno));
+		free(tmp);
+		free(path);
+		return;
+	}
+	size_t output_length = strlen(entry->output);
+	bool written = fwrite(entry->blob, 1, entry->blob_length, fp) == entry->blob_length
+		&& fwrite(entry->output, 1, output_length, fp) == output_length;
+	if (fclose(fp) != 0 || !written || rename(tmp, path) != 0) {
+		log_error("Failed to write cache file %s.\n", path);
+		unlink(tmp);
+	}
+	free(tmp);
+	free(path);
+}
+
+/* Mark the file as fresh again, without rewriting it. */
+static void touch_entry(const struct cache_entry *entry)
+{
+	char *path = get_cache_path(entry);
+	if (path == NULL) {
+		return;
+	}
+	if (utimensat(AT_FDCWD, path, NULL, 0) != 0) {
+		log_error("Failed to update cache file %s: %s.\n", path, strerror(errno));
+	}
+	free(path);
+}
+
+static struct cache_entry *find_entry(const struct provider_cache_key *key)
+{
+	struct cache_entry *entry;
+	wl_list_for_each(entry, &entries, link) {
+		if (provider_cache_key_equal(&entry->key, key)) {
+			return entry;
+		}
+	}
+
+	entry = xcalloc(1, sizeof(*entry));
+	entry->blob = key_blob(key, &entry->blob_length);
+	/* Point the key's strings back into the blob, which owns them. */
+	const char *cursor = entry->blob + strlen(entry->blob) + 1;
+	entry->key.format = key->format;
+	entry->key.label_field = cursor;
+	cursor += strlen(cursor) + 1;
+	entry->key.value_field = cursor;
+	cursor += strlen(cursor) + 1;
+	entry->key.tag = cursor;
+	cursor += strlen(cursor) + 1;
+	entry->key.cmd = cursor;
+	entry->proc.fd = -1;
+	wl_list_insert(&entries, &entry->link);
+	return entry;
+}
+
+static void start_refresh(struct cache_entry *entry, time_t now, uint32_t ttl)
+{
+	if (entry->proc.fd != -1 || now - entry->attempted < ttl) {
+		return;
+	}
+	if (num_refreshes >= PROVIDER_CACHE_MAX_REFRESHES) {
+		entry->queued = true;
+		entry->ttl = ttl;
+		return;
+	}
+	entry->queued = false;
+	entry->attempted = now;
+
+	if (!subprocess_start(&entry->proc, entry->key.cmd)) {
+		return;
+	}
+	num_refreshes++;
+	log_debug("Refreshing \"%s\" in the background.\n", entry->key.cmd);
+}
+
+static void start_queued_refreshes(void)
+{
+	time_t now = time(NULL);
+	struct cache_entry *entry;
+	wl_list_for_each(entry, &entries, link) {
+		if (num_refreshes >= PROVIDER_CACHE_MAX_REFRESHES) {
+			return;
+		}
+		if (entry->queued) {
+			start_refresh(entry, now, entry->ttl);
+		}
+	}
+}
+
+char *provider_cache_lookup(const struct provider_cache_key *key, const struct cache_policy *policy)
+{
+	struct cache_entry *entry = find_entry(key);
+	entry->persist |= policy->persist;
+	if (entry->output == NULL && policy->persist) {
+		load_entry(entry);
+	}
+	if (entry->output == NULL) {
+		return NULL;
+	}
+
+	time_t now = time(NULL);
+	if (now - entry->fetched >= policy->ttl) {
+		start_refresh(entry, now, policy->ttl);
+	}
+	return xstrdup(entry->output);
+}
+
+void provider_cache_store(
+		const struct provider_cache_key *key,
+		const struct cache_policy *policy,
+		const char *output)
+{
+	struct cache_entry *entry = find_entry(key);
+	free(entry->output);
+	entry->output = xstrdup(output);
+	entry->fetched = time(NULL);
+	entry->persist |= policy->persist;
+	if (entry->persist) {
+		save_entry(entry);
+	}
+}
+
+size_t provider_cache_pollfds(struct pollfd *fds, size_t max)
+{
+	size_t count = 0;
+	struct cache_entry *entry;
+	wl_list_for_each(entry, &entries, link) {
+		if (entry->proc.fd != -1 && count < max) {
+			fds[count].fd = entry->proc.fd;
+			fds[count].events = POLLIN;
+			fds[count].revents = 0;
+			count++;
+		}
+	}
+	return count;
+}
+
+void provider_cache_dispatch(
+		const struct pollfd *fds,
+		size_t count,
+		provider_cache_refresh_fn fn,
+		void *data)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+			continue;
+		}
+		struct cache_entry *entry;
+		wl_list_for_each(entry, &entries, link) {
+			if (entry->proc.fd == fds[i].fd) {
+				break;
+			}
+		}
+		if (&entry->link == &entries) {
+			continue;
+		}
+
+		if (!subprocess_read(&entry->proc)) {
+			/* More to come. */
+			continue;
+		}
+
+		bool success = subprocess_finish(&entry->proc);
+		num_refreshes--;
+		bool changed = success && strcmp(entry->proc.buffer, entry->output) != 0;
+		if (changed) {
+			log_debug("Refreshed \"%s\".\n", entry->key.cmd);
+			free(entry->output);
+			entry->output = entry->proc.buffer;
+			entry->proc.buffer = NULL;
+			entry->fetched = time(NULL);
+			if (entry->persist) {
+				save_entry(entry);
+			}
+		} else if (success) {
+			log_debug("Output of \"%s\" hasn't changed.\n", entry->key.cmd);
+			entry->fetched = time(NULL);
+			if (entry->persist) {
+				touch_entry(entry);
+			}
+		} else {
+			log_error("Refreshing \"%s\" failed, keeping old output.\n", entry->key.cmd);
+		}
+		free(entry->proc.buffer);
+		entry->proc.buffer = NULL;
+		start_queued_refreshes();
+		if (changed && fn != NULL) {
+			fn(&entry->key, data);
+		}
+	}
+}
+
+void provider_cache_destroy(void)
+{
+	struct cache_entry *entry;
+	struct cache_entry *tmp;
+	wl_list_for_each_safe(entry, tmp, &entries, link) {
+		if (entry->proc.fd != -1) {
+			subprocess_kill(&entry->proc);
+		}
+		wl_list_remove(&entry->link);
+		free(entry->blob);
+		free(entry->output);
+		free(entry);
+	}
+}
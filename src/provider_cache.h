@@ -0,0 +1,74 @@
+#ifndef PROVIDER_CACHE_H
+#define PROVIDER_CACHE_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nav.h"
+
+/*
+ * A cache of list command output, so that going back into a select level
+ * doesn't mean waiting for its provider all over again. Output is keyed on
+ * the command and on how it's parsed, and actions opt in with a cache_ttl
+ * (see struct cache_policy):
+ *
+ * - Output younger than the TTL is reused as is.
+ * - Older output is still returned straight away, but the command is re-run
+ *   in the background. Its pipe is polled from the main loop, and once it
+ *   exits successfully its output replaces the old.
+ *
+ * Entries with persist set are also saved under
+ * $XDG_CACHE_HOME/hypr-tofi/lists/, so they survive between runs. A refresh
+ * still running when we exit is abandoned, and simply happens again next
+ * time.
+ *
+ * Every string in a key must be set, if only to "". tag is anything else the
+ * output depends on, so that changing it invalidates the cache.
+ */
+struct provider_cache_key {
+	const char *cmd;
+	format_t format;
+	const char *label_field;
+	const char *value_field;
+	const char *tag;
+};
+
+/*
+ * How many refreshes may run at once, and so how many fds we need polled.
+ * Any more wait for one of these to finish.
+ */
+#define PROVIDER_CACHE_MAX_REFRESHES 4
+
+/*
+ * Return a copy of the cached output for key, starting a refresh if it's
+ * stale, or NULL if nothing is cached yet.
+ */
+[[nodiscard("memory leaked")]]
+char *provider_cache_lookup(const struct provider_cache_key *key, const struct cache_policy *policy);
+
+void provider_cache_store(
+		const struct provider_cache_key *key,
+		const struct cache_policy *policy,
+		const char *output);
+
+/* Fill in up to max pollfds for running refreshes, returning how many. */
+size_t provider_cache_pollfds(struct pollfd *fds, size_t max);
+
+/*
+ * Read from any refreshes that are ready, and call fn with the key of each
+ * one whose output has changed. Output that hasn't changed just counts as
+ * fresh again.
+ */
+typedef void (*provider_cache_refresh_fn)(const struct provider_cache_key *key, void *data);
+
+void provider_cache_dispatch(
+		const struct pollfd *fds,
+		size_t count,
+		provider_cache_refresh_fn fn,
+		void *data);
+
+bool provider_cache_key_equal(const struct provider_cache_key *a, const struct provider_cache_key *b);
+
+void provider_cache_destroy(void);
+
+#endif /* PROVIDER_CACHE_H */
@@ -7,9 +7,16 @@
 #include <sys/mman.h>
 #include "matching.h"
 #include "string_vec.h"
+#include "threadpool.h"
 #include "unicode.h"
 #include "xmalloc.h"
 
+#undef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* Minimum number of entries to rank at once, see string_ref_vec_rank(). */
+#define RANK_BLOCK 64
+
 static int cmpstringp(const void *restrict a, const void *restrict b)
 {
 	struct scored_string *restrict str1 = (struct scored_string *)a;
@@ -27,14 +34,85 @@ static int cmpstringp(const void *restrict a, const void *restrict b)
 	return strcmp(str1->string, str2->string);
 }
 
+/*
+ * Rank entries by their combined history and search score, best first, with
+ * ties kept in the order they were added. The sum is done in 64 bits, as
+ * search scores can be anywhere in the int32_t range.
+ */
 static int cmpscorep(const void *restrict a, const void *restrict b)
 {
-	struct scored_string *restrict str1 = (struct scored_string *)a;
-	struct scored_string *restrict str2 = (struct scored_string *)b;
+	const struct scored_string_ref *restrict str1 = a;
+	const struct scored_string_ref *restrict str2 = b;
+
+	int64_t score1 = (int64_t)str1->history_score + str1->search_score;
+	int64_t score2 = (int64_t)str2->history_score + str2->search_score;
+	if (score1 != score2) {
+		return score1 < score2 ? 1 : -1;
+	}
+	return (str1->index > str2->index) - (str1->index < str2->index);
+}
 
-	int hist_diff = str2->history_score - str1->history_score;
-	int search_diff = str2->search_score - str1->search_score;
-	return hist_diff + search_diff;
+static void swap(struct scored_string_ref *a, struct scored_string_ref *b)
+{
+	struct scored_string_ref tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+/*
+ * Partially order buf, so that its first k entries are the k best, in no
+ * particular order. This is quickselect with a median-of-three pivot, which
+ * gives up and sorts the remaining range if it recurses too deeply, so the
+ * worst case is O(n log n) rather than O(n^2).
+ */
+static void select_best(struct scored_string_ref *restrict buf, size_t len, size_t k)
+{
+	size_t lo = 0;
+	size_t hi = len;
+	size_t depth_limit = 2;
+	for (size_t i = len; i > 1; i /= 2) {
+		depth_limit += 2;
+	}
+
+	/*
+	 * Everything before lo ranks above everything in [lo, hi), which ranks
+	 * above everything from hi onwards, so we're done once k is on one of
+	 * those boundaries.
+	 */
+	while (lo < k && k < hi) {
+		if (depth_limit-- == 0) {
+			qsort(&buf[lo], hi - lo, sizeof(buf[0]), cmpscorep);
+			return;
+		}
+
+		/* Move the median of the first, middle and last entries to the end. */
+		size_t mid = lo + (hi - lo) / 2;
+		size_t last = hi - 1;
+		if (cmpscorep(&buf[mid], &buf[lo]) < 0) {
+			swap(&buf[mid], &buf[lo]);
+		}
+		if (cmpscorep(&buf[last], &buf[lo]) < 0) {
+			swap(&buf[last], &buf[lo]);
+		}
+		if (cmpscorep(&buf[mid], &buf[last]) < 0) {
+			swap(&buf[mid], &buf[last]);
+		}
+
+		size_t pivot = lo;
+		for (size_t i = lo; i < last; i++) {
+			if (cmpscorep(&buf[i], &buf[last]) < 0) {
+				swap(&buf[i], &buf[pivot]);
+				pivot++;
+			}
+		}
+		swap(&buf[pivot], &buf[last]);
+
+		if (k <= pivot) {
+			hi = pivot;
+		} else {
+			lo = pivot + 1;
+		}
+	}
 }
 
 struct string_vec string_vec_create(void)
@@ -52,6 +130,7 @@ struct string_ref_vec string_ref_vec_create(void)
 	struct string_ref_vec vec = {
 		.count = 0,
 		.size = 128,
+		.sorted = 0,
 		.buf = xcalloc(128, sizeof(*vec.buf)),
 	};
 	return vec;
@@ -75,6 +154,7 @@ struct string_ref_vec string_ref_vec_copy(const struct string_ref_vec *restrict
 	struct string_ref_vec copy = {
 		.count = vec->count,
 		.size = vec->size,
+		.sorted = vec->sorted,
 		.buf = xcalloc(vec->size, sizeof(*copy.buf)),
 	};
 
@@ -82,6 +162,11 @@ struct string_ref_vec string_ref_vec_copy(const struct string_ref_vec *restrict
 		copy.buf[i].string = vec->buf[i].string;
 		copy.buf[i].search_score = vec->buf[i].search_score;
 		copy.buf[i].history_score = vec->buf[i].history_score;
+		copy.buf[i].key = vec->buf[i].key;
+		copy.buf[i].key_map = vec->buf[i].key_map;
+		copy.buf[i].mask = vec->buf[i].mask;
+		copy.buf[i].index = vec->buf[i].index;
+		copy.buf[i].data = vec->buf[i].data;
 	}
 
 	return copy;
@@ -106,6 +191,17 @@ void string_vec_add(struct string_vec *restrict vec, const char *restrict str)
 }
 
 void string_ref_vec_add(struct string_ref_vec *restrict vec, char *restrict str)
+{
+	/* Without a key, we don't know the mask, so never reject. */
+	string_ref_vec_add_keyed(vec, str, NULL, NULL, UINT64_MAX);
+}
+
+void string_ref_vec_add_keyed(
+		struct string_ref_vec *restrict vec,
+		char *restrict str,
+		char *restrict key,
+		uint32_t *restrict key_map,
+		uint64_t mask)
 {
 	if (vec->count == vec->size) {
 		vec->size *= 2;
@@ -114,6 +210,14 @@ void string_ref_vec_add(struct string_ref_vec *restrict vec, char *restrict str)
 	vec->buf[vec->count].string = str;
 	vec->buf[vec->count].search_score = 0;
 	vec->buf[vec->count].history_score = 0;
+	vec->buf[vec->count].key = key;
+	vec->buf[vec->count].key_map = key_map;
+	vec->buf[vec->count].mask = mask;
+	vec->buf[vec->count].index = vec->count;
+	vec->buf[vec->count].data = NULL;
+	if (vec->sorted == vec->count) {
+		vec->sorted++;
+	}
 	vec->count++;
 }
 
@@ -141,32 +245,297 @@ struct scored_string *string_vec_find_sorted(struct string_vec *restrict vec, co
 	return bsearch(&str, vec->buf, vec->count, sizeof(vec->buf[0]), cmpstringp);
 }
 
+/*
+ * Make sure the first n entries of vec are in their final order.
+ *
+ * Rather than sorting every match, we use quickselect to move the best
+ * entries to the front, and only sort those. Callers typically rank one
+ * result at a time as they draw them, so we rank at least RANK_BLOCK entries
+ * at once to avoid repeatedly partitioning the rest of the vector.
+ */
+void string_ref_vec_rank(struct string_ref_vec *restrict vec, size_t n)
+{
+	if (n > vec->count) {
+		n = vec->count;
+	}
+	if (n <= vec->sorted) {
+		return;
+	}
+	if (n < vec->sorted + RANK_BLOCK) {
+		n = MIN(vec->sorted + RANK_BLOCK, vec->count);
+	}
+
+	struct scored_string_ref *unsorted = &vec->buf[vec->sorted];
+	size_t len = vec->count - vec->sorted;
+	size_t k = n - vec->sorted;
+	if (k < len) {
+		select_best(unsorted, len, k);
+	}
+	qsort(unsorted, k, sizeof(unsorted[0]), cmpscorep);
+	vec->sorted = n;
+}
+
 struct scored_string_ref *string_ref_vec_find_sorted(struct string_ref_vec *restrict vec, const char * str)
 {
 	return bsearch(&str, vec->buf, vec->count, sizeof(vec->buf[0]), cmpstringp);
 }
 
+/*
+ * State shared by each chunk of a (possibly multi-threaded) filter. Each chunk
+ * writes its matches to its own vector, which are then merged in order. The
+ * candidates come from either vec or store.
+ */
+struct filter_job {
+	const struct string_ref_vec *vec;
+	const struct candidate_store *store;
+	const struct compiled_query *query;
+	struct string_ref_vec *results;
+	const atomic_bool *cancel;
+};
+
+/* How many candidates to match between checks for cancellation. */
+#define CANCEL_INTERVAL 1024
+
+static void filter_chunk(void *data, size_t chunk, size_t start, size_t end)
+{
+	struct filter_job *job = data;
+	const struct string_ref_vec *vec = job->vec;
+	const struct compiled_query *query = job->query;
+	const matcher_fn match = query->match;
+	struct string_ref_vec *filt = &job->results[chunk];
+	for (size_t i = start; i < end; i++) {
+		if (job->cancel != NULL
+				&& (i - start) % CANCEL_INTERVAL == 0
+				&& atomic_load_explicit(job->cancel, memory_order_relaxed)) {
+			return;
+		}
+		if (!match_mask_possible(vec->buf[i].mask, query->mask)) {
+			continue;
+		}
+		int32_t search_score;
+		search_score = match(query, vec->buf[i].string, vec->buf[i].key, NULL, NULL);
+		if (search_score != INT32_MIN) {
+			string_ref_vec_add_keyed(
+					filt,
+					vec->buf[i].string,
+					vec->buf[i].key,
+					vec->buf[i].key_map,
+					vec->buf[i].mask);
+			struct scored_string_ref *res = &filt->buf[filt->count - 1];
+			res->search_score = search_score;
+			res->history_score = vec->buf[i].history_score;
+			res->data = vec->buf[i].data;
+		}
+	}
+}
+
+static void filter_store_chunk(void *data, size_t chunk, size_t start, size_t end)
+{
+	struct filter_job *job = data;
+	const struct candidate_store *store = job->store;
+	const struct compiled_query *query = job->query;
+	const matcher_fn match = query->match;
+	struct string_ref_vec *filt = &job->results[chunk];
+	for (size_t i = start; i < end; i++) {
+		if (job->cancel != NULL
+				&& (i - start) % CANCEL_INTERVAL == 0
+				&& atomic_load_explicit(job->cancel, memory_order_relaxed)) {
+			return;
+		}
+		if (!match_mask_possible(store->masks[i], query->mask)) {
+			continue;
+		}
+		char *key = &store->keys[store->key_offsets[i]];
+		int32_t search_score;
+		search_score = match(query, &store->labels[store->label_offsets[i]], key, NULL, NULL);
+		if (search_score != INT32_MIN) {
+			string_ref_vec_add_keyed(filt, store->strings[i], key, store->key_maps[i], store->masks[i]);
+			struct scored_string_ref *res = &filt->buf[filt->count - 1];
+			res->search_score = search_score;
+			res->history_score = store->history_scores[i];
+			res->data = store->data[i];
+		}
+	}
+}
+
+/* Run fn over count candidates, in as many chunks as is worthwhile. */
+static struct string_ref_vec run_filter(
+		struct filter_job *job,
+		size_t count,
+		threadpool_fn fn,
+		const char *restrict substr,
+		enum matching_algorithm algorithm)
+{
+	size_t chunks = threadpool_chunks(count);
+	struct string_ref_vec single;
+	struct string_ref_vec *results = &single;
+	if (chunks > 1) {
+		results = xcalloc(chunks, sizeof(*results));
+	}
+	for (size_t i = 0; i < chunks; i++) {
+		results[i] = string_ref_vec_create();
+	}
+
+	struct compiled_query query = compiled_query_create(algorithm, substr);
+	job->query = &query;
+	job->results = results;
+	threadpool_run(count, chunks, fn, job);
+	compiled_query_destroy(&query);
+
+	struct string_ref_vec filt = single;
+	if (chunks > 1) {
+		filt = string_ref_vec_merge(results, chunks);
+		free(results);
+	}
+
+	/* Leave ranking the results by score until they're needed. */
+	filt.sorted = 0;
+	return filt;
+}
+
 struct string_ref_vec string_ref_vec_filter(
 		const struct string_ref_vec *restrict vec,
 		const char *restrict substr,
-		enum matching_algorithm algorithm)
+		enum matching_algorithm algorithm,
+		const atomic_bool *cancel)
 {
 	if (substr[0] == '\0') {
 		return string_ref_vec_copy(vec);
 	}
-	struct string_ref_vec filt = string_ref_vec_create();
-	for (size_t i = 0; i < vec->count; i++) {
-		int32_t search_score;
-		search_score = match_words(algorithm, substr, vec->buf[i].string);
-		if (search_score != INT32_MIN) {
-			string_ref_vec_add(&filt, vec->buf[i].string);
-			filt.buf[filt.count - 1].search_score = search_score;
-			filt.buf[filt.count - 1].history_score = vec->buf[i].history_score;
+
+	struct filter_job job = {
+		.vec = vec,
+		.cancel = cancel,
+	};
+	return run_filter(&job, vec->count, filter_chunk, substr, algorithm);
+}
+
+/*
+ * Append str to a growable blob, returning its offset, or UINT32_MAX if the
+ * blob would outgrow 32-bit offsets.
+ */
+static uint32_t blob_append(char **blob, size_t *len, size_t *size, const char *str)
+{
+	size_t n = strlen(str) + 1;
+	if (*len + n > UINT32_MAX) {
+		return UINT32_MAX;
+	}
+	if (*len + n > *size) {
+		while (*len + n > *size) {
+			*size *= 2;
 		}
+		*blob = xrealloc(*blob, *size);
 	}
-	/* Sort the results by their search score. */
-	qsort(filt.buf, filt.count, sizeof(filt.buf[0]), cmpscorep);
-	return filt;
+	uint32_t offset = *len;
+	memcpy(*blob + offset, str, n);
+	*len += n;
+	return offset;
+}
+
+bool candidate_store_init(struct candidate_store *store, const struct string_ref_vec *restrict vec)
+{
+	size_t count = vec->count;
+	size_t labels_len = 0;
+	size_t labels_size = 4096;
+	size_t keys_len = 0;
+	size_t keys_size = 4096;
+	*store = (struct candidate_store){
+		.count = count,
+		.labels = xmalloc(labels_size),
+		.keys = xmalloc(keys_size),
+		.label_offsets = xcalloc(count, sizeof(*store->label_offsets)),
+		.key_offsets = xcalloc(count, sizeof(*store->key_offsets)),
+		.masks = xcalloc(count, sizeof(*store->masks)),
+		.history_scores = xcalloc(count, sizeof(*store->history_scores)),
+		.strings = xcalloc(count, sizeof(*store->strings)),
+		.key_maps = xcalloc(count, sizeof(*store->key_maps)),
+		.data = xcalloc(count, sizeof(*store->data)),
+	};
+
+	for (size_t i = 0; i < count; i++) {
+		const struct scored_string_ref *ref = &vec->buf[i];
+		char *folded = NULL;
+		const char *key = ref->key;
+		uint64_t mask = ref->mask;
+		if (key == NULL) {
+			/* Match the matchers, which fall back to the raw string. */
+			folded = utf8_fold(ref->string);
+			key = folded ? folded : ref->string;
+			mask = match_mask(ref->string, key);
+		}
+		uint32_t label_offset = blob_append(&store->labels, &labels_len, &labels_size, ref->string);
+		uint32_t key_offset = blob_append(&store->keys, &keys_len, &keys_size, key);
+		free(folded);
+		if (label_offset == UINT32_MAX || key_offset == UINT32_MAX) {
+			candidate_store_destroy(store);
+			return false;
+		}
+		store->label_offsets[i] = label_offset;
+		store->key_offsets[i] = key_offset;
+		store->masks[i] = mask;
+		store->history_scores[i] = ref->history_score;
+		store->strings[i] = ref->string;
+		store->key_maps[i] = ref->key_map;
+		store->data[i] = ref->data;
+	}
+	return true;
+}
+
+void candidate_store_destroy(struct candidate_store *store)
+{
+	free(store->labels);
+	free(store->keys);
+	free(store->label_offsets);
+	free(store->key_offsets);
+	free(store->masks);
+	free(store->history_scores);
+	free(store->strings);
+	free(store->key_maps);
+	free(store->data);
+	*store = (struct candidate_store){ 0 };
+}
+
+struct string_ref_vec candidate_store_filter(
+		const struct candidate_store *store,
+		const char *restrict substr,
+		enum matching_algorithm algorithm,
+		const atomic_bool *cancel)
+{
+	struct filter_job job = {
+		.store = store,
+		.cancel = cancel,
+	};
+	return run_filter(&job, store->count, filter_store_chunk, substr, algorithm);
+}
+
+/*
+ * Concatenate count vectors, in order, into a new vector, destroying them in
+ * the process. Used to merge the results of a multi-threaded filter, so that
+ * they're in the same order as if filtered on a single thread.
+ */
+struct string_ref_vec string_ref_vec_merge(struct string_ref_vec *restrict vecs, size_t count)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < count; i++) {
+		total += vecs[i].count;
+	}
+
+	struct string_ref_vec merged = {
+		.count = 0,
+		.sorted = 0,
+		.size = total > 128 ? total : 128,
+	};
+	merged.buf = xcalloc(merged.size, sizeof(*merged.buf));
+
+	for (size_t i = 0; i < count; i++) {
+		for (size_t j = 0; j < vecs[i].count; j++) {
+			merged.buf[merged.count] = vecs[i].buf[j];
+			merged.buf[merged.count].index = merged.count;
+			merged.count++;
+		}
+		string_ref_vec_destroy(&vecs[i]);
+	}
+	return merged;
 }
 
 struct string_ref_vec string_ref_vec_from_buffer(char *buffer)
@@ -1,6 +1,7 @@
 #ifndef STRING_VEC_H
 #define STRING_VEC_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -35,16 +36,42 @@ struct scored_string *string_vec_find_sorted(struct string_vec *restrict vec, co
  * Like a string_vec, but only store a reference to the corresponding string
  * rather than copying it. Although compatible with the string_vec struct, we
  * create a new struct to make the compiler complain if we mix them up.
+ *
+ * key optionally references a pre-folded copy of string (see utf8_fold()),
+ * owned by whoever owns string, which lets filtering skip case-folding every
+ * candidate on every keystroke. key_map is its match_key_map(), if it needs
+ * one, owned likewise. mask is the corresponding match_mask(), used to reject
+ * candidates without running the matcher. index is the position the string
+ * was added at, used to keep ties in their original order.
+ *
+ * data optionally points back at whatever the string belongs to (e.g. a
+ * nav_result), and is carried through filtering, so a selected string never
+ * has to be looked up again by its text.
+ *
+ * These are placed last to keep the leading fields compatible with struct
+ * scored_string.
  */
 struct scored_string_ref {
 	char *string;
 	int32_t search_score;
 	int32_t history_score;
+	char *key;
+	uint32_t *key_map;
+	uint64_t mask;
+	size_t index;
+	void *data;
 };
 
+/*
+ * Filtering leaves its results unranked, as usually only the first page is
+ * ever shown. The first `sorted` entries are in their final order, and the
+ * rest are ranked lazily with string_ref_vec_rank() as they're needed.
+ * Vectors that are only ever appended to stay fully sorted.
+ */
 struct string_ref_vec {
 	size_t count;
 	size_t size;
+	size_t sorted;
 	struct scored_string_ref *buf;
 };
 
@@ -63,15 +90,76 @@ struct string_ref_vec string_ref_vec_copy(const struct string_ref_vec *restrict
 
 void string_ref_vec_add(struct string_ref_vec *restrict vec, char *restrict str);
 
+void string_ref_vec_add_keyed(
+		struct string_ref_vec *restrict vec,
+		char *restrict str,
+		char *restrict key,
+		uint32_t *restrict key_map,
+		uint64_t mask);
+
+void string_ref_vec_rank(struct string_ref_vec *restrict vec, size_t n);
+
 void string_vec_uniq(struct string_vec *restrict vec);
 
 struct scored_string_ref *string_ref_vec_find_sorted(struct string_ref_vec *restrict vec, const char *str);
 
+/*
+ * Return the entries of vec that match substr, unranked. If cancel is set
+ * (by another thread) part-way through, the results are incomplete.
+ */
 [[nodiscard("memory leaked")]]
 struct string_ref_vec string_ref_vec_filter(
 		const struct string_ref_vec *restrict vec,
 		const char *restrict substr,
-		enum matching_algorithm algorithm);
+		enum matching_algorithm algorithm,
+		const atomic_bool *cancel);
+
+/*
+ * A packed copy of a string_ref_vec, for filtering the same list over and
+ * over. Filtering a string_ref_vec chases a pointer to a separately allocated
+ * string for every candidate, whereas here the labels and their folded keys
+ * are copied back to back into two blobs, and everything else the filter
+ * reads lives in parallel arrays, so a pass over the whole list streams
+ * linearly through memory. Most candidates are rejected by their mask alone,
+ * without touching either blob.
+ *
+ * strings, key_maps and data hold the original entries' pointers, which are
+ * only read for matches, so results reference the same strings as the source
+ * vector.
+ * Their keys point into the store, so it must outlive them.
+ */
+struct candidate_store {
+	size_t count;
+	char *labels;
+	char *keys;
+	uint32_t *label_offsets;
+	uint32_t *key_offsets;
+	uint64_t *masks;
+	int32_t *history_scores;
+	char **strings;
+	uint32_t **key_maps;
+	void **data;
+};
+
+/*
+ * Pack vec into store. Entries without a key are folded here, once. Returns
+ * false (leaving store empty) if the labels won't fit in 32-bit offsets.
+ */
+[[nodiscard]]
+bool candidate_store_init(struct candidate_store *store, const struct string_ref_vec *restrict vec);
+
+void candidate_store_destroy(struct candidate_store *store);
+
+/* As string_ref_vec_filter(), for the vector store was made from. */
+[[nodiscard("memory leaked")]]
+struct string_ref_vec candidate_store_filter(
+		const struct candidate_store *store,
+		const char *restrict substr,
+		enum matching_algorithm algorithm,
+		const atomic_bool *cancel);
+
+[[nodiscard("memory leaked")]]
+struct string_ref_vec string_ref_vec_merge(struct string_ref_vec *restrict vecs, size_t count);
 
 [[nodiscard("memory leaked")]]
 struct string_ref_vec string_ref_vec_from_buffer(char *buffer);
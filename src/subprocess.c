@@ -0,0 +1,93 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "log.h"
+#include "subprocess.h"
+#include "xmalloc.h"
+
+extern char **environ;
+
+bool subprocess_start(struct subprocess *proc, const char *cmd)
+{
+	*proc = (struct subprocess){ .fd = -1 };
+
+	int pipefd[2];
+	if (pipe2(pipefd, O_CLOEXEC) == -1) {
+		log_error("Failed to create pipe: %s.\n", strerror(errno));
+		return false;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+
+	char *argv[] = {"sh", "-c", (char *)cmd, NULL};
+	int res = posix_spawnp(&proc->pid, "sh", &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(pipefd[1]);
+	if (res != 0) {
+		log_error("Failed to run \"%s\": %s.\n", cmd, strerror(res));
+		close(pipefd[0]);
+		return false;
+	}
+
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+	proc->fd = pipefd[0];
+	proc->size = 4096;
+	proc->buffer = xmalloc(proc->size);
+	proc->buffer[0] = '\0';
+	return true;
+}
+
+bool subprocess_read(struct subprocess *proc)
+{
+	while (true) {
+		if (proc->size - proc->length < 4096) {
+			proc->size *= 2;
+			proc->buffer = xrealloc(proc->buffer, proc->size);
+		}
+		ssize_t bytes = read(proc->fd, &proc->buffer[proc->length], proc->size - proc->length - 1);
+		if (bytes > 0) {
+			proc->length += bytes;
+			proc->buffer[proc->length] = '\0';
+			continue;
+		}
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+		/* Anything but "try again later" means there's no more to come. */
+		return bytes == 0 || errno != EAGAIN;
+	}
+}
+
+void subprocess_consume(struct subprocess *proc, size_t length)
+{
+	memmove(proc->buffer, &proc->buffer[length], proc->length - length + 1);
+	proc->length -= length;
+}
+
+bool subprocess_finish(struct subprocess *proc)
+{
+	close(proc->fd);
+	proc->fd = -1;
+
+	int status;
+	if (waitpid(proc->pid, &status, 0) == -1) {
+		return false;
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void subprocess_kill(struct subprocess *proc)
+{
+	kill(proc->pid, SIGTERM);
+	subprocess_finish(proc);
+	free(proc->buffer);
+	proc->buffer = NULL;
+}
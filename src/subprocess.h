@@ -0,0 +1,44 @@
+#ifndef SUBPROCESS_H
+#define SUBPROCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * A shell command running in the background, whose output is collected
+ * through a non-blocking pipe. Poll fd for POLLIN, call subprocess_read()
+ * whenever it's readable, and once that reports the end of the output, reap
+ * the command with subprocess_finish().
+ *
+ * The command's stdin is /dev/null, and it inherits our environment.
+ */
+struct subprocess {
+	pid_t pid;
+	int fd;
+	char *buffer;
+	size_t length;
+	size_t size;
+};
+
+bool subprocess_start(struct subprocess *proc, const char *cmd);
+
+/*
+ * Read whatever output is available, returning true once it's all been read.
+ * buffer always holds a NUL-terminated copy of the output so far.
+ */
+bool subprocess_read(struct subprocess *proc);
+
+/* Throw away the first length bytes of buffer, once they've been dealt with. */
+void subprocess_consume(struct subprocess *proc, size_t length);
+
+/*
+ * Wait for the command to exit, returning whether it succeeded. The caller
+ * takes ownership of buffer.
+ */
+bool subprocess_finish(struct subprocess *proc);
+
+/* Kill the command and throw away its output. */
+void subprocess_kill(struct subprocess *proc);
+
+#endif /* SUBPROCESS_H */
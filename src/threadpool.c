@@ -0,0 +1,180 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <unistd.h>
+#include "log.h"
+#include "threadpool.h"
+#include "xmalloc.h"
+
+/*
+ * Split each job into a few chunks per thread, so that one thread getting
+ * unlucky with expensive items doesn't hold everyone else up.
+ */
+#define CHUNKS_PER_THREAD 4
+
+static struct {
+	size_t threshold;
+	bool started;
+	bool quit;
+
+	/* Number of worker threads, not including the caller. */
+	size_t num_threads;
+	thrd_t *threads;
+
+	mtx_t lock;
+	cnd_t work_available;
+	cnd_t work_done;
+
+	/* The current job. */
+	uint64_t generation;
+	threadpool_fn fn;
+	void *data;
+	size_t count;
+	size_t chunks;
+	size_t next_chunk;
+	size_t chunks_remaining;
+} pool;
+
+static int worker(void *arg);
+static void start_threads(void);
+static void run_chunks(void);
+
+void threadpool_init(size_t threshold)
+{
+	pool.threshold = threshold;
+}
+
+void threadpool_destroy(void)
+{
+	if (pool.threads == NULL) {
+		pool.started = false;
+		return;
+	}
+	mtx_lock(&pool.lock);
+	pool.quit = true;
+	cnd_broadcast(&pool.work_available);
+	mtx_unlock(&pool.lock);
+
+	for (size_t i = 0; i < pool.num_threads; i++) {
+		thrd_join(pool.threads[i], NULL);
+	}
+	free(pool.threads);
+	pool.threads = NULL;
+	cnd_destroy(&pool.work_done);
+	cnd_destroy(&pool.work_available);
+	mtx_destroy(&pool.lock);
+	pool.started = false;
+}
+
+size_t threadpool_chunks(size_t count)
+{
+	if (pool.threshold == 0 || count < pool.threshold) {
+		return 1;
+	}
+	if (!pool.started) {
+		start_threads();
+	}
+	if (pool.num_threads == 0) {
+		return 1;
+	}
+	return (pool.num_threads + 1) * CHUNKS_PER_THREAD;
+}
+
+void threadpool_run(size_t count, size_t chunks, threadpool_fn fn, void *data)
+{
+	if (chunks <= 1 || !pool.started) {
+		fn(data, 0, 0, count);
+		return;
+	}
+
+	mtx_lock(&pool.lock);
+	pool.fn = fn;
+	pool.data = data;
+	pool.count = count;
+	pool.chunks = chunks;
+	pool.next_chunk = 0;
+	pool.chunks_remaining = chunks;
+	pool.generation++;
+	cnd_broadcast(&pool.work_available);
+
+	run_chunks();
+	while (pool.chunks_remaining > 0) {
+		cnd_wait(&pool.work_done, &pool.lock);
+	}
+	pool.fn = NULL;
+	mtx_unlock(&pool.lock);
+}
+
+/*
+ * Claim and process chunks of the current job until there are none left.
+ * Must be called with the lock held, which is released while working.
+ */
+void run_chunks(void)
+{
+	while (pool.next_chunk < pool.chunks) {
+		size_t chunk = pool.next_chunk++;
+		size_t start = pool.count * chunk / pool.chunks;
+		size_t end = pool.count * (chunk + 1) / pool.chunks;
+		threadpool_fn fn = pool.fn;
+		void *data = pool.data;
+
+		mtx_unlock(&pool.lock);
+		fn(data, chunk, start, end);
+		mtx_lock(&pool.lock);
+
+		pool.chunks_remaining--;
+		if (pool.chunks_remaining == 0) {
+			cnd_signal(&pool.work_done);
+		}
+	}
+}
+
+int worker(void *arg)
+{
+	(void)arg;
+	uint64_t generation = 0;
+
+	mtx_lock(&pool.lock);
+	while (true) {
+		while (!pool.quit && pool.generation == generation) {
+			cnd_wait(&pool.work_available, &pool.lock);
+		}
+		if (pool.quit) {
+			break;
+		}
+		generation = pool.generation;
+		run_chunks();
+	}
+	mtx_unlock(&pool.lock);
+	return 0;
+}
+
+void start_threads(void)
+{
+	pool.started = true;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus <= 1) {
+		pool.num_threads = 0;
+		return;
+	}
+
+	if (mtx_init(&pool.lock, mtx_plain) != thrd_success
+			|| cnd_init(&pool.work_available) != thrd_success
+			|| cnd_init(&pool.work_done) != thrd_success) {
+		log_error("Failed to initialise thread pool, filtering on one thread.\n");
+		pool.num_threads = 0;
+		return;
+	}
+
+	pool.threads = xcalloc((size_t)cpus - 1, sizeof(*pool.threads));
+	for (long i = 0; i < cpus - 1; i++) {
+		if (thrd_create(&pool.threads[pool.num_threads], worker, NULL) != thrd_success) {
+			log_error("Failed to create worker thread.\n");
+			break;
+		}
+		pool.num_threads++;
+	}
+	log_debug("Started %zu worker threads.\n", pool.num_threads);
+}
@@ -0,0 +1,30 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h>
+
+/*
+ * A small, persistent pool of worker threads, one per CPU, used to split up
+ * work over large lists (e.g. filtering candidates). Work is divided into
+ * contiguous chunks, in order, so callers can merge per-chunk results
+ * deterministically.
+ *
+ * Threads are only started the first time a list reaches the threshold
+ * passed to threadpool_init(). Smaller lists are processed on the calling
+ * thread, as a single chunk.
+ */
+typedef void (*threadpool_fn)(void *data, size_t chunk, size_t start, size_t end);
+
+void threadpool_init(size_t threshold);
+void threadpool_destroy(void);
+
+/* Return the number of chunks a list of count items will be split into. */
+size_t threadpool_chunks(size_t count);
+
+/*
+ * Call fn once for each of the chunks of a list of count items, and wait for
+ * them all to finish. The calling thread processes chunks too.
+ */
+void threadpool_run(size_t count, size_t chunks, threadpool_fn fn, void *data);
+
+#endif /* THREADPOOL_H */
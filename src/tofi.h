@@ -94,11 +94,13 @@ struct tofi {
 	struct wl_list nav_stack;
 	struct nav_level *nav_current;
 	struct wl_list base_results;
+	struct arena base_arena;
 	struct value_dict *base_dict;
 	char base_prompt[MAX_PROMPT_LENGTH];
 
 	uint32_t anchor;
 	bool use_scale;
+	uint32_t parallel_filter_threshold;
 	char target_output_name[MAX_OUTPUT_NAME_LEN];
 };
 
@@ -101,26 +101,6 @@ size_t utf8_strlen(const char *s)
 	return g_utf8_strlen(s, -1);
 }
 
-char *utf8_strcasestr(const char * restrict haystack, const char * restrict needle)
-{
-	char *h = g_utf8_casefold(haystack, -1);
-	char *n = g_utf8_casefold(needle, -1);
-
-	char *cmp = strstr(h, n);
-	char *ret;
-
-	if (cmp == NULL) {
-		ret = NULL;
-	} else {
-		ret = (char *)haystack + (cmp - h);
-	}
-
-	free(h);
-	free(n);
-
-	return ret;
-}
-
 char *utf8_normalize(const char *s)
 {
 	return g_utf8_normalize(s, -1, G_NORMALIZE_DEFAULT);
@@ -131,6 +111,21 @@ char *utf8_compose(const char *s)
 	return g_utf8_normalize(s, -1, G_NORMALIZE_DEFAULT_COMPOSE);
 }
 
+/*
+ * Return a normalised, case-folded copy of s, suitable for caseless
+ * comparison with strstr() and friends. Returns NULL if s is invalid.
+ */
+char *utf8_fold(const char *s)
+{
+	char *normalized = utf8_normalize(s);
+	if (normalized == NULL) {
+		return NULL;
+	}
+	char *folded = g_utf8_casefold(normalized, -1);
+	free(normalized);
+	return folded;
+}
+
 bool utf8_validate(const char *s)
 {
 	return g_utf8_validate(s, -1, NULL);
@@ -24,9 +24,9 @@ char *utf8_prev_char(const char *s);
 char *utf8_strchr(const char *s, uint32_t c);
 char *utf8_strcasechr(const char *s, uint32_t c);
 size_t utf8_strlen(const char *s);
-char *utf8_strcasestr(const char * restrict haystack, const char * restrict needle);
 char *utf8_normalize(const char *s);
 char *utf8_compose(const char *s);
+char *utf8_fold(const char *s);
 bool utf8_validate(const char *s);
 
 #endif /* UNICODE_H */
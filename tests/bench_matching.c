@@ -0,0 +1,486 @@
+/*
+ * Micro-benchmarks for the matching hot path.
+ *
+ * Usage: bench_matching [max-entries [parallel-filter-threshold]]
+ *
+ * Synthetic corpora of 1k up to max-entries (default 1M) entries are filtered
+ * one keystroke at a time, with each of the matching algorithms. Every
+ * keystroke is printed as a JSON object on its own line, so runs on different
+ * branches can be compared with a script.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/desktop_vec.h"
+#include "../src/filter.h"
+#include "../src/matching.h"
+#include "../src/nav.h"
+#include "../src/string_vec.h"
+#include "../src/threadpool.h"
+#include "../src/unicode.h"
+#include "../src/xmalloc.h"
+
+#undef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* Each keystroke is repeated until roughly this many candidates are matched. */
+#define TARGET_WORK 2000000
+
+/* Nav levels are filtered on the main thread, so don't make millions of them. */
+#define MAX_NAV_ENTRIES 100000
+
+enum corpus_kind {
+	CORPUS_ASCII,
+	CORPUS_CJK,
+	CORPUS_PATHS,
+	CORPUS_DESKTOP,
+};
+
+static const char *corpus_names[] = {
+	[CORPUS_ASCII] = "ascii",
+	[CORPUS_CJK] = "cjk",
+	[CORPUS_PATHS] = "paths",
+	[CORPUS_DESKTOP] = "desktop",
+};
+
+static const char *algorithm_names[] = {
+	[MATCHING_ALGORITHM_NORMAL] = "normal",
+	[MATCHING_ALGORITHM_PREFIX] = "prefix",
+	[MATCHING_ALGORITHM_FUZZY] = "fuzzy",
+};
+
+static const char *words[] = {
+	"firefox", "terminal", "editor", "settings", "system", "monitor",
+	"file", "manager", "music", "player", "video", "image", "viewer",
+	"network", "text", "office", "calc", "writer", "browser", "mail",
+	"chat", "code", "studio", "power", "disk", "usage", "camera", "maps",
+	"weather", "clock", "calendar", "notes", "tasks", "backup", "archive",
+	"font", "color", "picker", "screen", "shot", "recorder", "remote",
+	"desktop", "keyboard", "mouse", "sound", "printer", "scanner", "share",
+	"local", "config", "cache", "theme", "icon", "emulator", "graphics",
+};
+
+static const char *extensions[] = {
+	"desktop", "png", "svg", "conf", "so", "txt", "json", "toml",
+};
+
+/* Queries that are expensive for one reason or another. */
+static const char *pathological[] = {
+	/* Matches almost everything. */
+	"e",
+	/* Lots of partial matches for the fuzzy matcher to score. */
+	"eeeeeeee",
+	/* Lots of words, each of which has to match. */
+	"a b c d e f g h",
+	/* Rejected by the character mask. */
+	"zqxj",
+	/* A long query. */
+	"terminal emulator for the desktop",
+};
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng(void)
+{
+	/* xorshift64*, so that corpora are the same on every run. */
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+static const char *random_word(void)
+{
+	return words[rng() % (sizeof(words) / sizeof(words[0]))];
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+/* Append a word to buf, capitalised sometimes, like application names. */
+static size_t append_word(char *buf, size_t len, size_t size, const char *word)
+{
+	int n;
+	if (rng() % 3 == 0) {
+		n = snprintf(&buf[len], size - len, "%c%s", word[0] - 'a' + 'A', &word[1]);
+	} else {
+		n = snprintf(&buf[len], size - len, "%s", word);
+	}
+	return MIN(len + (size_t)n, size - 1);
+}
+
+static char *make_ascii(void)
+{
+	char buf[128];
+	size_t len = 0;
+	size_t count = 1 + rng() % 4;
+	for (size_t i = 0; i < count; i++) {
+		if (i > 0) {
+			buf[len++] = ' ';
+		}
+		len = append_word(buf, len, sizeof(buf), random_word());
+	}
+	if (rng() % 4 == 0) {
+		snprintf(&buf[len], sizeof(buf) - len, " %u", (unsigned)(rng() % 100));
+	}
+	return xstrdup(buf);
+}
+
+static char *make_cjk(void)
+{
+	char buf[128];
+	size_t len = 0;
+	size_t count = 2 + rng() % 7;
+	for (size_t i = 0; i < count; i++) {
+		/* Mostly from a small block, so that queries have matches. */
+		uint32_t c = 0x4E00 + rng() % 512;
+		len += utf32_to_utf8(c, &buf[len]);
+	}
+	if (rng() % 3 == 0) {
+		buf[len++] = ' ';
+		len = append_word(buf, len, sizeof(buf), random_word());
+	}
+	buf[len] = '\0';
+	return xstrdup(buf);
+}
+
+static char *make_path(void)
+{
+	char buf[256];
+	size_t len = 0;
+	size_t depth = 3 + rng() % 5;
+	for (size_t i = 0; i < depth; i++) {
+		buf[len++] = '/';
+		len = append_word(buf, len, sizeof(buf), random_word());
+		if (rng() % 3 == 0) {
+			buf[len++] = rng() % 2 ? '-' : '_';
+			len = append_word(buf, len, sizeof(buf), random_word());
+		}
+	}
+	snprintf(&buf[len], sizeof(buf) - len, "%u.%s",
+			(unsigned)(rng() % 1000),
+			extensions[rng() % (sizeof(extensions) / sizeof(extensions[0]))]);
+	return xstrdup(buf);
+}
+
+static char *make_keywords(void)
+{
+	char buf[128];
+	size_t len = 0;
+	size_t count = rng() % 5;
+	for (size_t i = 0; i < count; i++) {
+		len += snprintf(&buf[len], sizeof(buf) - len, "%s;", random_word());
+	}
+	buf[len] = '\0';
+	return xstrdup(buf);
+}
+
+struct corpus {
+	enum corpus_kind kind;
+	size_t count;
+	char **strings;
+	char **keys;
+	struct string_ref_vec vec;
+	struct desktop_vec desktop;
+	struct arena nav_arena;
+	struct wl_list nav;
+	struct nav_view nav_view;
+};
+
+/* Initialised in place, as the nav results link back to the list head. */
+static void corpus_init(struct corpus *corpus, enum corpus_kind kind, size_t count)
+{
+	*corpus = (struct corpus){
+		.kind = kind,
+		.count = count,
+		.strings = xcalloc(count, sizeof(char *)),
+		.keys = xcalloc(count, sizeof(char *)),
+		.vec = string_ref_vec_create(),
+		.desktop = desktop_vec_create(),
+	};
+	wl_list_init(&corpus->nav);
+
+	for (size_t i = 0; i < count; i++) {
+		char *str;
+		switch (kind) {
+			case CORPUS_CJK:
+				str = make_cjk();
+				break;
+			case CORPUS_PATHS:
+				str = make_path();
+				break;
+			case CORPUS_ASCII:
+			case CORPUS_DESKTOP:
+			default:
+				str = make_ascii();
+				break;
+		}
+		corpus->strings[i] = str;
+
+		if (kind == CORPUS_DESKTOP) {
+			char id[32];
+			snprintf(id, sizeof(id), "app%zu.desktop", i);
+			char *keywords = make_keywords();
+			desktop_vec_add(&corpus->desktop, id, str, id, keywords);
+			free(keywords);
+			continue;
+		}
+
+		corpus->keys[i] = utf8_fold(str);
+		string_ref_vec_add_keyed(&corpus->vec, str, corpus->keys[i], NULL, match_mask(str, corpus->keys[i]));
+
+		if (kind == CORPUS_ASCII && i < MAX_NAV_ENTRIES) {
+			struct nav_result *res = nav_result_create(&corpus->nav_arena);
+			res->label = str;
+			res->value = str;
+			res->mask = match_mask(res->label, NULL);
+			wl_list_insert(corpus->nav.prev, &res->link);
+		}
+	}
+}
+
+static void corpus_destroy(struct corpus *corpus)
+{
+	for (size_t i = 0; i < corpus->count; i++) {
+		free(corpus->strings[i]);
+		free(corpus->keys[i]);
+	}
+	free(corpus->strings);
+	free(corpus->keys);
+	string_ref_vec_destroy(&corpus->vec);
+	desktop_vec_destroy(&corpus->desktop);
+	arena_destroy(&corpus->nav_arena);
+	nav_view_destroy(&corpus->nav_view);
+}
+
+/*
+ * The text typed for a corpus' typing sequence. For CJK, use the start of an
+ * entry, so that it definitely matches something.
+ */
+static void typing_text(const struct corpus *corpus, char *buf, size_t size)
+{
+	switch (corpus->kind) {
+		case CORPUS_CJK: {
+			const char *str = corpus->strings[corpus->count / 2];
+			const char *end = str;
+			for (size_t i = 0; i < 3 && *end != '\0'; i++) {
+				end = utf8_next_char(end);
+			}
+			snprintf(buf, size, "%.*s", (int)(end - str), str);
+			break;
+		}
+		case CORPUS_PATHS:
+			snprintf(buf, size, "share font");
+			break;
+		case CORPUS_DESKTOP:
+			snprintf(buf, size, "text editor");
+			break;
+		case CORPUS_ASCII:
+		default:
+			snprintf(buf, size, "music player");
+			break;
+	}
+}
+
+enum bench_target {
+	TARGET_STRING_REF_VEC,
+	TARGET_FILTER_SESSION,
+	TARGET_DESKTOP_VEC,
+	TARGET_NAV,
+};
+
+static const char *target_names[] = {
+	[TARGET_STRING_REF_VEC] = "string_ref_vec_filter",
+	[TARGET_FILTER_SESSION] = "filter_session_update",
+	[TARGET_DESKTOP_VEC] = "desktop_vec_filter",
+	[TARGET_NAV] = "nav_results_filter",
+};
+
+struct bench {
+	enum bench_target target;
+	struct corpus *corpus;
+	size_t entries;
+	enum matching_algorithm algorithm;
+	struct filter_session session;
+};
+
+/* Run a single keystroke once, returning the number of matches. */
+static size_t run_once(struct bench *bench, const char *query)
+{
+	struct string_ref_vec results;
+	size_t count;
+	switch (bench->target) {
+		case TARGET_FILTER_SESSION:
+			return filter_session_update(&bench->session, query)->count;
+		case TARGET_DESKTOP_VEC:
+			results = desktop_vec_filter(&bench->corpus->desktop, query, bench->algorithm);
+			count = results.count;
+			string_ref_vec_destroy(&results);
+			return count;
+		case TARGET_NAV:
+			results = string_ref_vec_create();
+			nav_results_filter(&bench->corpus->nav_view, &bench->corpus->nav, query, &results);
+			count = results.count;
+			string_ref_vec_destroy(&results);
+			return count;
+		case TARGET_STRING_REF_VEC:
+		default:
+			results = string_ref_vec_filter(&bench->corpus->vec, query, bench->algorithm, NULL);
+			count = results.count;
+			string_ref_vec_destroy(&results);
+			return count;
+	}
+}
+
+static void print_json_string(const char *str)
+{
+	putchar('"');
+	for (const char *c = str; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			putchar('\\');
+		}
+		putchar(*c);
+	}
+	putchar('"');
+}
+
+/*
+ * Time a keystroke, and print the result. A filter session is stateful, so
+ * is only run once per keystroke, but everything else is repeated and the
+ * fastest time taken, to reduce noise on small corpora.
+ */
+static void run_keystroke(struct bench *bench, const char *sequence, const char *query)
+{
+	size_t reps = 1;
+	if (bench->target != TARGET_FILTER_SESSION) {
+		reps = MIN(50, TARGET_WORK / bench->entries + 1);
+	}
+
+	uint64_t best = UINT64_MAX;
+	uint64_t total = 0;
+	size_t matches = 0;
+	for (size_t i = 0; i < reps; i++) {
+		uint64_t start = now_ns();
+		matches = run_once(bench, query);
+		uint64_t elapsed = now_ns() - start;
+		total += elapsed;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"entries\":%zu,"
+			"\"algorithm\":\"%s\",\"sequence\":\"%s\",\"query\":",
+			target_names[bench->target],
+			corpus_names[bench->corpus->kind],
+			bench->entries,
+			algorithm_names[bench->algorithm],
+			sequence);
+	print_json_string(query);
+	printf(",\"matches\":%zu,\"reps\":%zu,\"ns\":%llu,\"mean_ns\":%llu,"
+			"\"candidates_per_sec\":%.0f}\n",
+			matches,
+			reps,
+			(unsigned long long)best,
+			(unsigned long long)(total / reps),
+			best ? bench->entries * 1e9 / best : 0.0);
+}
+
+/* Type text one character at a time, then delete it again. */
+static void run_typing(struct bench *bench, const char *text)
+{
+	char query[256];
+	size_t prefixes[256];
+	size_t num_prefixes = 0;
+	for (const char *c = text; *c != '\0' && num_prefixes < 256; ) {
+		c = utf8_next_char(c);
+		prefixes[num_prefixes++] = c - text;
+	}
+
+	for (size_t i = 0; i < num_prefixes; i++) {
+		snprintf(query, sizeof(query), "%.*s", (int)prefixes[i], text);
+		run_keystroke(bench, "typing", query);
+	}
+	for (size_t i = num_prefixes; i > 1; i--) {
+		snprintf(query, sizeof(query), "%.*s", (int)prefixes[i - 2], text);
+		run_keystroke(bench, "backspace", query);
+	}
+}
+
+static void run_pathological(struct bench *bench)
+{
+	for (size_t i = 0; i < sizeof(pathological) / sizeof(pathological[0]); i++) {
+		if (bench->target == TARGET_FILTER_SESSION) {
+			filter_session_reset(&bench->session);
+		}
+		run_keystroke(bench, "pathological", pathological[i]);
+	}
+}
+
+static void run_bench(enum bench_target target, struct corpus *corpus, enum matching_algorithm algorithm)
+{
+	struct bench bench = {
+		.target = target,
+		.corpus = corpus,
+		.entries = target == TARGET_NAV ? MIN(corpus->count, MAX_NAV_ENTRIES) : corpus->count,
+		.algorithm = algorithm,
+	};
+	if (target == TARGET_FILTER_SESSION) {
+		bench.session = filter_session_create(&corpus->vec, algorithm);
+	}
+
+	char text[256];
+	typing_text(corpus, text, sizeof(text));
+	run_typing(&bench, text);
+	run_pathological(&bench);
+
+	if (target == TARGET_FILTER_SESSION) {
+		filter_session_destroy(&bench.session);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t max_entries = 1000000;
+	size_t threshold = 20000;
+	if (argc > 1) {
+		max_entries = strtoull(argv[1], NULL, 0);
+	}
+	if (argc > 2) {
+		threshold = strtoull(argv[2], NULL, 0);
+	}
+	threadpool_init(threshold);
+
+	for (size_t entries = 1000; entries <= max_entries; entries *= 10) {
+		for (enum corpus_kind kind = CORPUS_ASCII; kind <= CORPUS_DESKTOP; kind++) {
+			struct corpus corpus;
+			corpus_init(&corpus, kind, entries);
+			for (enum matching_algorithm algorithm = MATCHING_ALGORITHM_NORMAL;
+					algorithm <= MATCHING_ALGORITHM_FUZZY;
+					algorithm++) {
+				if (kind == CORPUS_DESKTOP) {
+					run_bench(TARGET_DESKTOP_VEC, &corpus, algorithm);
+					continue;
+				}
+				run_bench(TARGET_STRING_REF_VEC, &corpus, algorithm);
+				run_bench(TARGET_FILTER_SESSION, &corpus, algorithm);
+			}
+			if (kind == CORPUS_ASCII && entries <= MAX_NAV_ENTRIES) {
+				/* Nav levels are always fuzzy matched. */
+				run_bench(TARGET_NAV, &corpus, MATCHING_ALGORITHM_FUZZY);
+			}
+			corpus_destroy(&corpus);
+			fflush(stdout);
+		}
+	}
+
+	threadpool_destroy();
+	return EXIT_SUCCESS;
+}
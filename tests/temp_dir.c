@@ -0,0 +1,31 @@
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "temp_dir.h"
+
+char *make_temp_dir(const char *prefix)
+{
+	char *dir = NULL;
+	if (asprintf(&dir, "/tmp/%s.XXXXXX", prefix) < 0) {
+		return NULL;
+	}
+	if (mkdtemp(dir) == NULL) {
+		free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
+static int remove_file(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+void remove_temp_dir(char *dir)
+{
+	if (dir == NULL) {
+		return;
+	}
+	nftw(dir, remove_file, 16, FTW_DEPTH | FTW_PHYS);
+	free(dir);
+}
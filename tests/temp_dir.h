@@ -0,0 +1,14 @@
+#ifndef TEMP_DIR_H
+#define TEMP_DIR_H
+
+/*
+ * Create an empty directory under /tmp for a test to work in, with a name
+ * starting with prefix. Returns its path, or NULL on failure.
+ */
+[[nodiscard("memory leaked")]]
+char *make_temp_dir(const char *prefix);
+
+/* Remove dir and everything in it, and free the path. */
+void remove_temp_dir(char *dir);
+
+#endif /* TEMP_DIR_H */
@@ -336,6 +336,51 @@ static void test_skip_value_array(void)
 	TEST_ASSERT_TRUE(json_peek_char(&p, '\0') || *p.pos == '\0');
 }
 
+static void test_skip_value_long_string(void)
+{
+	char json[1024];
+	json[0] = '"';
+	memset(&json[1], 'x', 1000);
+	strcpy(&json[1001], "\",2");
+	
+	json_parser_t p;
+	json_parser_init(&p, json);
+	
+	TEST_ASSERT_TRUE(json_skip_value(&p));
+	TEST_ASSERT_EQUAL_STRING(",2", p.pos);
+	TEST_ASSERT_NULL(json_get_error(&p));
+}
+
+static void test_skip_value_escaped_string(void)
+{
+	json_parser_t p;
+	json_parser_init(&p, "\"say \\\"hi\\\" C:\\\\\",\"\\\\\",3");
+	
+	TEST_ASSERT_TRUE(json_skip_value(&p));
+	TEST_ASSERT_EQUAL_STRING(",\"\\\\\",3", p.pos);
+	p.pos++;
+	TEST_ASSERT_TRUE(json_skip_value(&p));
+	TEST_ASSERT_EQUAL_STRING(",3", p.pos);
+}
+
+static void test_skip_value_unterminated(void)
+{
+	json_parser_t p;
+	json_parser_init(&p, "\"no end");
+	TEST_ASSERT_FALSE(json_skip_value(&p));
+	TEST_ASSERT_NOT_NULL(json_get_error(&p));
+	
+	json_parser_init(&p, "\"escaped end\\\"");
+	TEST_ASSERT_FALSE(json_skip_value(&p));
+	TEST_ASSERT_NOT_NULL(json_get_error(&p));
+	
+	json_parser_init(&p, "\"trailing backslash\\");
+	TEST_ASSERT_FALSE(json_skip_value(&p));
+	
+	json_parser_init(&p, "{\"a\":[1,\"b");
+	TEST_ASSERT_FALSE(json_skip_value(&p));
+}
+
 static void test_builder_simple_object(void)
 {
 	json_builder_t b;
@@ -585,6 +630,9 @@ int main(void)
 	RUN_TEST(test_skip_value_string);
 	RUN_TEST(test_skip_value_object);
 	RUN_TEST(test_skip_value_array);
+	RUN_TEST(test_skip_value_long_string);
+	RUN_TEST(test_skip_value_escaped_string);
+	RUN_TEST(test_skip_value_unterminated);
 	
 	RUN_TEST(test_builder_simple_object);
 	RUN_TEST(test_builder_with_numbers);
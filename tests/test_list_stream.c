@@ -0,0 +1,220 @@
+#include "unity.h"
+#include "temp_dir.h"
+#include "../src/list_stream.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Each stream runs `cat` on a FIFO, so the test decides exactly where the
+ * command's output is split between reads.
+ */
+static char *dir;
+static char fifo[256];
+static struct arena arena;
+static struct wl_list results;
+
+void setUp(void)
+{
+	dir = make_temp_dir("test_list_stream");
+	TEST_ASSERT_NOT_NULL(dir);
+	snprintf(fifo, sizeof(fifo), "%s/fifo", dir);
+	TEST_ASSERT_TRUE(mkfifo(fifo, 0600) == 0);
+	wl_list_init(&results);
+}
+
+void tearDown(void)
+{
+	remove_temp_dir(dir);
+	dir = NULL;
+	arena_destroy(&arena);
+}
+
+static struct list_stream *start(format_t format, bool keep_output, int *writer)
+{
+	char cmd[sizeof(fifo) + 8];
+	snprintf(cmd, sizeof(cmd), "cat %s", fifo);
+	struct list_parser parser = {
+		.format = format,
+		.label_field = "name",
+		.value_field = "id",
+		.arena = &arena,
+	};
+	struct list_stream *stream = list_stream_create(cmd, &parser, keep_output);
+	if (stream == NULL) {
+		return NULL;
+	}
+	/* This blocks until cat has opened the other end. */
+	*writer = open(fifo, O_WRONLY);
+	if (*writer < 0) {
+		list_stream_destroy(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+static void write_all(int writer, const char *text)
+{
+	TEST_ASSERT_EQUAL_SIZE(strlen(text), (size_t)write(writer, text, strlen(text)));
+}
+
+/*
+ * Read from stream until there are count results, or until nothing more
+ * turns up for a second. Returns whether the command has finished.
+ */
+static bool read_until(struct list_stream *stream, size_t count)
+{
+	while ((size_t)wl_list_length(&results) < count) {
+		struct pollfd pfd = { .fd = stream->proc.fd, .events = POLLIN };
+		if (poll(&pfd, 1, 1000) <= 0) {
+			return false;
+		}
+		if (list_stream_read(stream, &results)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void finish(struct list_stream *stream, int writer)
+{
+	close(writer);
+	while (!read_until(stream, SIZE_MAX)) {
+	}
+}
+
+static void assert_results(size_t count, const char *const labels[], const char *const values[])
+{
+	TEST_ASSERT_EQUAL_SIZE(count, (size_t)wl_list_length(&results));
+	size_t i = 0;
+	struct nav_result *res;
+	wl_list_for_each(res, &results, link) {
+		TEST_ASSERT_EQUAL_STRING(labels[i], res->label);
+		TEST_ASSERT_EQUAL_STRING(values[i], res->value);
+		i++;
+	}
+}
+
+static void test_lines_split_across_reads(void)
+{
+	int writer;
+	struct list_stream *stream = start(FORMAT_LINES, false, &writer);
+	TEST_ASSERT_NOT_NULL(stream);
+	
+	write_all(writer, "one\ntw");
+	TEST_ASSERT_FALSE(read_until(stream, 1));
+	assert_results(1, (const char *[]){"one"}, (const char *[]){"one"});
+	
+	write_all(writer, "o\n  \n three \nfo");
+	TEST_ASSERT_FALSE(read_until(stream, 3));
+	write_all(writer, "ur");
+	finish(stream, writer);
+	
+	const char *labels[] = {"one", "two", "three", "four"};
+	assert_results(4, labels, labels);
+	list_stream_destroy(stream);
+}
+
+static void test_ndjson_split_across_reads(void)
+{
+	int writer;
+	struct list_stream *stream = start(FORMAT_JSON, false, &writer);
+	TEST_ASSERT_NOT_NULL(stream);
+	
+	write_all(writer, "{\"name\":\"a\",\"id\":\"1\"}\n{\"name\":\"b\",");
+	TEST_ASSERT_FALSE(read_until(stream, 1));
+	assert_results(1, (const char *[]){"a"}, (const char *[]){"1"});
+	
+	/* Records sharing a line are parsed once the line is complete. */
+	write_all(writer, "\"id\":\"2\"}\n{\"name\":\"c\"} {\"na");
+	TEST_ASSERT_FALSE(read_until(stream, 2));
+	assert_results(2, (const char *[]){"a", "b"}, (const char *[]){"1", "2"});
+	write_all(writer, "me\":\"d\",\"id\":\"4\"}\n");
+	finish(stream, writer);
+	
+	assert_results(4,
+		(const char *[]){"a", "b", "c", "d"},
+		(const char *[]){"1", "2", "c", "4"});
+	list_stream_destroy(stream);
+}
+
+static void test_incomplete_trailing_record(void)
+{
+	int writer;
+	struct list_stream *stream = start(FORMAT_JSON, false, &writer);
+	TEST_ASSERT_NOT_NULL(stream);
+	
+	write_all(writer, "{\"name\":\"a\"}\n{\"name\":\"b\"");
+	finish(stream, writer);
+	
+	assert_results(1, (const char *[]){"a"}, (const char *[]){"a"});
+	list_stream_destroy(stream);
+}
+
+static void test_json_array(void)
+{
+	int writer;
+	struct list_stream *stream = start(FORMAT_JSON, true, &writer);
+	TEST_ASSERT_NOT_NULL(stream);
+	
+	/* Nothing can be parsed until the whole array is there. */
+	write_all(writer, " [{\"name\":\"a\",\"id\":\"1\"},\n");
+	TEST_ASSERT_FALSE(read_until(stream, 1));
+	TEST_ASSERT_EQUAL_SIZE(0, (size_t)wl_list_length(&results));
+	
+	write_all(writer, "{\"name\":\"b\",\"id\":\"2\"}]\n");
+	finish(stream, writer);
+	
+	assert_results(2, (const char *[]){"a", "b"}, (const char *[]){"1", "2"});
+	TEST_ASSERT_EQUAL_STRING(
+		" [{\"name\":\"a\",\"id\":\"1\"},\n{\"name\":\"b\",\"id\":\"2\"}]\n",
+		stream->output);
+	list_stream_destroy(stream);
+}
+
+static void test_keep_output(void)
+{
+	int writer;
+	struct list_stream *stream = start(FORMAT_LINES, true, &writer);
+	TEST_ASSERT_NOT_NULL(stream);
+	
+	write_all(writer, "one\ntw");
+	TEST_ASSERT_FALSE(read_until(stream, 1));
+	write_all(writer, "o\n");
+	finish(stream, writer);
+	
+	const char *labels[] = {"one", "two"};
+	assert_results(2, labels, labels);
+	TEST_ASSERT_EQUAL_STRING("one\ntwo\n", stream->output);
+	list_stream_destroy(stream);
+}
+
+static void test_parse_whole_output(void)
+{
+	struct list_parser parser = {
+		.format = FORMAT_JSON,
+		.label_field = "name",
+		.value_field = "id",
+		.arena = &arena,
+	};
+	list_parse(&parser, "[{\"name\":\"a\"},{\"id\":\"no label\"},{\"name\":\"b\",\"id\":\"2\"}]", &results);
+	assert_results(2, (const char *[]){"a", "b"}, (const char *[]){"a", "2"});
+}
+
+int main(void)
+{
+	UnityBegin("test_list_stream.c");
+	
+	RUN_TEST(test_lines_split_across_reads);
+	RUN_TEST(test_ndjson_split_across_reads);
+	RUN_TEST(test_incomplete_trailing_record);
+	RUN_TEST(test_json_array);
+	RUN_TEST(test_keep_output);
+	RUN_TEST(test_parse_whole_output);
+	
+	return UnityEnd();
+}
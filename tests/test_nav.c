@@ -0,0 +1,281 @@
+#include "unity.h"
+#include "../src/nav.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_dict_empty(void)
+{
+	struct value_dict *dict = dict_create();
+	
+	TEST_ASSERT_NULL(dict_get(dict, "missing"));
+	
+	dict_destroy(dict);
+}
+
+static void test_dict_set_get(void)
+{
+	struct value_dict *dict = dict_create();
+	dict_set(&dict, "name", "value");
+	dict_set(&dict, "other", "thing");
+	
+	TEST_ASSERT_EQUAL_STRING("value", dict_get(dict, "name"));
+	TEST_ASSERT_EQUAL_STRING("thing", dict_get(dict, "other"));
+	TEST_ASSERT_NULL(dict_get(dict, "missing"));
+	TEST_ASSERT_NULL(dict_get(dict, ""));
+	
+	dict_destroy(dict);
+}
+
+static void test_dict_overwrite(void)
+{
+	char long_value[100];
+	memset(long_value, 'l', sizeof(long_value) - 1);
+	long_value[sizeof(long_value) - 1] = '\0';
+	
+	struct value_dict *dict = dict_create();
+	dict_set(&dict, "key", "short");
+	dict_set(&dict, "key", long_value);
+	TEST_ASSERT_EQUAL_STRING(long_value, dict_get(dict, "key"));
+	dict_set(&dict, "key", "short again");
+	TEST_ASSERT_EQUAL_STRING("short again", dict_get(dict, "key"));
+	
+	dict_destroy(dict);
+}
+
+static void test_dict_set_own_value(void)
+{
+	char long_value[100];
+	memset(long_value, 'l', sizeof(long_value) - 1);
+	long_value[sizeof(long_value) - 1] = '\0';
+	
+	struct value_dict *dict = dict_create();
+	dict_set(&dict, "short", "inline");
+	dict_set(&dict, "long", long_value);
+	dict_set(&dict, "short", dict_get(dict, "short"));
+	dict_set(&dict, "long", dict_get(dict, "long"));
+	
+	TEST_ASSERT_EQUAL_STRING("inline", dict_get(dict, "short"));
+	TEST_ASSERT_EQUAL_STRING(long_value, dict_get(dict, "long"));
+	
+	dict_destroy(dict);
+}
+
+static void test_dict_grow(void)
+{
+	struct value_dict *dict = dict_create();
+	char key[16];
+	char value[64];
+	for (int i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		snprintf(value, sizeof(value), "a value long enough to be spilled %d", i);
+		dict_set(&dict, key, value);
+	}
+	for (int i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		snprintf(value, sizeof(value), "a value long enough to be spilled %d", i);
+		TEST_ASSERT_EQUAL_STRING(value, dict_get(dict, key));
+	}
+	
+	dict_destroy(dict);
+}
+
+static void test_dict_long_key(void)
+{
+	char key[NAV_KEY_MAX * 2];
+	memset(key, 'k', sizeof(key) - 1);
+	key[sizeof(key) - 1] = '\0';
+	
+	struct value_dict *dict = dict_create();
+	dict_set(&dict, key, "value");
+	
+	/* Keys are truncated, so anything sharing the stored prefix matches. */
+	key[NAV_KEY_MAX - 1] = '\0';
+	TEST_ASSERT_EQUAL_STRING("value", dict_get(dict, key));
+	
+	dict_destroy(dict);
+}
+
+static void test_dict_copy_on_write(void)
+{
+	char long_value[100];
+	memset(long_value, 'l', sizeof(long_value) - 1);
+	long_value[sizeof(long_value) - 1] = '\0';
+	
+	struct value_dict *parent = dict_create();
+	dict_set(&parent, "shared", "parent");
+	dict_set(&parent, "long", long_value);
+	
+	struct value_dict *child = dict_copy(parent);
+	dict_set(&child, "shared", "child");
+	dict_set(&child, "added", "child only");
+	
+	TEST_ASSERT_EQUAL_STRING("parent", dict_get(parent, "shared"));
+	TEST_ASSERT_NULL(dict_get(parent, "added"));
+	TEST_ASSERT_EQUAL_STRING("child", dict_get(child, "shared"));
+	TEST_ASSERT_EQUAL_STRING("child only", dict_get(child, "added"));
+	
+	/* The copy's spilled values must be its own. */
+	dict_destroy(parent);
+	TEST_ASSERT_EQUAL_STRING(long_value, dict_get(child, "long"));
+	
+	dict_destroy(child);
+}
+
+static void test_dict_copy_unchanged(void)
+{
+	struct value_dict *parent = dict_create();
+	dict_set(&parent, "key", "value");
+	
+	struct value_dict *child = dict_copy(parent);
+	TEST_ASSERT_EQUAL_STRING("value", dict_get(child, "key"));
+	
+	/* Each reference is dropped separately. */
+	dict_destroy(parent);
+	TEST_ASSERT_EQUAL_STRING("value", dict_get(child, "key"));
+	
+	dict_destroy(child);
+}
+
+static char *resolve(const char *text, struct value_dict *dict)
+{
+	struct template *template = template_compile(text);
+	char *result = template_resolve(template, dict);
+	template_destroy(template);
+	return result;
+}
+
+static void test_template_empty(void)
+{
+	TEST_ASSERT_NULL(template_compile(""));
+	TEST_ASSERT_NULL(template_compile(NULL));
+	TEST_ASSERT_NULL(template_resolve(NULL, NULL));
+}
+
+static void test_template_literal(void)
+{
+	char *result = resolve("no keys here", NULL);
+	TEST_ASSERT_EQUAL_STRING("no keys here", result);
+	free(result);
+}
+
+static void test_template_keys(void)
+{
+	struct value_dict *dict = dict_create();
+	dict_set(&dict, "cmd", "notify-send");
+	dict_set(&dict, "title", "Hello");
+	
+	char *result = resolve("{cmd} '{title}, {title}!'", dict);
+	TEST_ASSERT_EQUAL_STRING("notify-send 'Hello, Hello!'", result);
+	free(result);
+	
+	dict_destroy(dict);
+}
+
+static void test_template_unknown_key(void)
+{
+	struct value_dict *dict = dict_create();
+	dict_set(&dict, "known", "yes");
+	
+	char *result = resolve("a{unknown}b{known}c{}d", dict);
+	TEST_ASSERT_EQUAL_STRING("abyescd", result);
+	free(result);
+	
+	result = resolve("{unknown}", NULL);
+	TEST_ASSERT_EQUAL_STRING("", result);
+	free(result);
+	
+	dict_destroy(dict);
+}
+
+static void test_template_trailing_brace(void)
+{
+	struct value_dict *dict = dict_create();
+	dict_set(&dict, "key", "value");
+	
+	char *result = resolve("text {", dict);
+	TEST_ASSERT_EQUAL_STRING("text ", result);
+	free(result);
+	
+	/* An unclosed key still runs to the end of the template. */
+	result = resolve("text {key", dict);
+	TEST_ASSERT_EQUAL_STRING("text value", result);
+	free(result);
+	
+	result = resolve("{{key}}", dict);
+	TEST_ASSERT_EQUAL_STRING("}", result);
+	free(result);
+	
+	dict_destroy(dict);
+}
+
+static void test_template_long_value(void)
+{
+	/* Longer than the fixed buffers templates used to be resolved into. */
+	size_t length = NAV_VALUE_MAX * 3;
+	char *value = malloc(length + 1);
+	memset(value, 'v', length);
+	value[length] = '\0';
+	
+	struct value_dict *dict = dict_create();
+	dict_set(&dict, "long", value);
+	
+	char *result = resolve("<{long}|{long}>", dict);
+	TEST_ASSERT_EQUAL_SIZE(2 * length + 3, strlen(result));
+	TEST_ASSERT_EQUAL_MEMORY("<", result, 1);
+	TEST_ASSERT_EQUAL_MEMORY(value, result + 1, length);
+	TEST_ASSERT_EQUAL_MEMORY("|", result + 1 + length, 1);
+	TEST_ASSERT_EQUAL_MEMORY(value, result + 2 + length, length);
+	TEST_ASSERT_EQUAL_STRING(">", result + 2 + 2 * length);
+	free(result);
+	
+	dict_destroy(dict);
+	free(value);
+}
+
+static void test_template_long_literal(void)
+{
+	size_t length = NAV_TEMPLATE_MAX * 4;
+	char *text = malloc(length + 6);
+	memset(text, 't', length);
+	strcpy(text + length, "{key}");
+	
+	struct value_dict *dict = dict_create();
+	dict_set(&dict, "key", "!");
+	
+	char *result = resolve(text, dict);
+	TEST_ASSERT_EQUAL_SIZE(length + 1, strlen(result));
+	TEST_ASSERT_EQUAL_MEMORY(text, result, length);
+	TEST_ASSERT_EQUAL_STRING("!", result + length);
+	free(result);
+	
+	dict_destroy(dict);
+	free(text);
+}
+
+int main(void)
+{
+	UnityBegin("test_nav.c");
+	
+	RUN_TEST(test_dict_empty);
+	RUN_TEST(test_dict_set_get);
+	RUN_TEST(test_dict_overwrite);
+	RUN_TEST(test_dict_set_own_value);
+	RUN_TEST(test_dict_grow);
+	RUN_TEST(test_dict_long_key);
+	RUN_TEST(test_dict_copy_on_write);
+	RUN_TEST(test_dict_copy_unchanged);
+	
+	RUN_TEST(test_template_empty);
+	RUN_TEST(test_template_literal);
+	RUN_TEST(test_template_keys);
+	RUN_TEST(test_template_unknown_key);
+	RUN_TEST(test_template_trailing_brace);
+	RUN_TEST(test_template_long_value);
+	RUN_TEST(test_template_long_literal);
+	
+	return UnityEnd();
+}
@@ -0,0 +1,162 @@
+#include "unity.h"
+#include "temp_dir.h"
+#include "../src/path_index.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Each test gets two directories to put in $PATH, and a cache directory of
+ * its own, under a temporary directory.
+ */
+static char *root;
+static char first[256];
+static char second[256];
+static char cache[256];
+static char *saved_path;
+
+static void make_file(const char *dir, const char *name, mode_t mode)
+{
+	char path[sizeof(first) + 64];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	TEST_ASSERT_TRUE(fd >= 0);
+	close(fd);
+}
+
+void setUp(void)
+{
+	root = make_temp_dir("test_path_index");
+	TEST_ASSERT_NOT_NULL(root);
+	snprintf(first, sizeof(first), "%s/first", root);
+	snprintf(second, sizeof(second), "%s/second", root);
+	snprintf(cache, sizeof(cache), "%s/cache", root);
+	TEST_ASSERT_TRUE(mkdir(first, 0700) == 0);
+	TEST_ASSERT_TRUE(mkdir(second, 0700) == 0);
+	
+	make_file(first, "both", 0700);
+	make_file(first, "shadowed", 0600);
+	make_file(first, "data", 0600);
+	make_file(second, "both", 0700);
+	make_file(second, "shadowed", 0700);
+	make_file(second, "only-second", 0700);
+	
+	char subdir[sizeof(first) + 16];
+	snprintf(subdir, sizeof(subdir), "%s/subdir", first);
+	TEST_ASSERT_TRUE(mkdir(subdir, 0700) == 0);
+	make_file(subdir, "tool", 0700);
+	
+	saved_path = strdup(getenv("PATH"));
+	char path[sizeof(first) * 3];
+	snprintf(path, sizeof(path), "%s:%s/missing:%s", first, root, second);
+	setenv("PATH", path, 1);
+	setenv("XDG_CACHE_HOME", cache, 1);
+}
+
+void tearDown(void)
+{
+	setenv("PATH", saved_path, 1);
+	free(saved_path);
+	remove_temp_dir(root);
+	root = NULL;
+}
+
+static void assert_lookups(const struct path_index *index)
+{
+	TEST_ASSERT_TRUE(path_index_contains(index, "both"));
+	TEST_ASSERT_TRUE(path_index_contains(index, "only-second"));
+	TEST_ASSERT_FALSE(path_index_contains(index, "missing"));
+	TEST_ASSERT_FALSE(path_index_contains(index, ""));
+}
+
+static void test_lookup(void)
+{
+	struct path_index *index = path_index_create();
+	assert_lookups(index);
+	path_index_destroy(index);
+}
+
+static void test_not_executable(void)
+{
+	struct path_index *index = path_index_create();
+	
+	/* The first one found isn't executable, but a later one is. */
+	TEST_ASSERT_TRUE(path_index_contains(index, "shadowed"));
+	TEST_ASSERT_FALSE(path_index_contains(index, "data"));
+	/* Directories aren't commands. */
+	TEST_ASSERT_FALSE(path_index_contains(index, "subdir"));
+	
+	path_index_destroy(index);
+}
+
+static void test_relative_path(void)
+{
+	struct path_index *index = path_index_create();
+	
+	TEST_ASSERT_TRUE(path_index_contains(index, "subdir/tool"));
+	TEST_ASSERT_FALSE(path_index_contains(index, "subdir/missing"));
+	
+	path_index_destroy(index);
+}
+
+static void test_cached(void)
+{
+	struct path_index *index = path_index_create();
+	path_index_destroy(index);
+	
+	char path[sizeof(cache) + 32];
+	snprintf(path, sizeof(path), "%s/hypr-tofi/path", cache);
+	struct stat st;
+	TEST_ASSERT_TRUE(stat(path, &st) == 0);
+	
+	/* The second index comes from the cache, and must agree. */
+	index = path_index_create();
+	assert_lookups(index);
+	path_index_destroy(index);
+}
+
+static void test_cache_invalidated(void)
+{
+	struct path_index *index = path_index_create();
+	TEST_ASSERT_FALSE(path_index_contains(index, "new"));
+	path_index_destroy(index);
+	
+	/* Adding a file changes its directory's mtime. */
+	make_file(second, "new", 0700);
+	struct timespec times[2] = {
+		{ .tv_sec = 12345, .tv_nsec = 0 },
+		{ .tv_sec = 12345, .tv_nsec = 0 },
+	};
+	TEST_ASSERT_TRUE(utimensat(AT_FDCWD, second, times, 0) == 0);
+	
+	index = path_index_create();
+	TEST_ASSERT_TRUE(path_index_contains(index, "new"));
+	assert_lookups(index);
+	path_index_destroy(index);
+}
+
+static void test_no_path(void)
+{
+	unsetenv("PATH");
+	
+	struct path_index *index = path_index_create();
+	TEST_ASSERT_FALSE(path_index_contains(index, "both"));
+	path_index_destroy(index);
+}
+
+int main(void)
+{
+	UnityBegin("test_path_index.c");
+	
+	RUN_TEST(test_lookup);
+	RUN_TEST(test_not_executable);
+	RUN_TEST(test_relative_path);
+	RUN_TEST(test_cached);
+	RUN_TEST(test_cache_invalidated);
+	RUN_TEST(test_no_path);
+	
+	return UnityEnd();
+}
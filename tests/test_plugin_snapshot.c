@@ -0,0 +1,243 @@
+#include "unity.h"
+#include "temp_dir.h"
+#include "../src/plugin.h"
+#include "../src/plugin_snapshot.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Each test gets a plugin directory and a cache directory (for the snapshot)
+ * of its own, under a temporary directory.
+ */
+static char *root;
+static char dir[256];
+static char cache[256];
+
+static const char *alpha =
+	"name = \"alpha\"\n"
+	"display_prefix = \"Alpha\"\n"
+	"global = true\n"
+	"depends = [\"sh\"]\n"
+	"list_cmd = \"printf 'a\\nb\\n'\"\n"
+	"format = \"json\"\n"
+	"label_field = \"title\"\n"
+	"value_field = \"id\"\n"
+	"cache_ttl = 60\n"
+	"cache_key = \"v2\"\n"
+	"on_select.selection_type = \"input\"\n"
+	"on_select.template = \"open {value}\"\n"
+	"\n"
+	"[[action]]\n"
+	"label = \"First\"\n"
+	"template = \"first {x}\"\n"
+	"\n"
+	"[[action]]\n"
+	"label = \"Second\"\n"
+	"selection_type = \"select\"\n"
+	"list_cmd = \"echo x\"\n"
+	"on_select.template = \"second {x}\"\n";
+
+static const char *beta =
+	"name = \"beta\"\n"
+	"depends = [\"sh\", \"no-such-command-for-hypr-tofi-tests\"]\n";
+
+static void write_file(const char *name, const char *contents)
+{
+	char path[sizeof(dir) + 32];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *fp = fopen(path, "w");
+	TEST_ASSERT_NOT_NULL(fp);
+	fputs(contents, fp);
+	fclose(fp);
+}
+
+void setUp(void)
+{
+	root = make_temp_dir("test_plugin_snapshot");
+	TEST_ASSERT_NOT_NULL(root);
+	snprintf(dir, sizeof(dir), "%s/plugins", root);
+	snprintf(cache, sizeof(cache), "%s/cache", root);
+	TEST_ASSERT_TRUE(mkdir(dir, 0700) == 0);
+	setenv("XDG_CACHE_HOME", cache, 1);
+	
+	write_file("alpha.toml", alpha);
+	write_file("beta.toml", beta);
+	write_file("ignored.txt", "name = \"ignored\"\n");
+	
+	/* Parse the directory, which saves its snapshot. */
+	plugin_init();
+	plugin_load_directory(dir);
+}
+
+void tearDown(void)
+{
+	plugin_destroy();
+	remove_temp_dir(root);
+	root = NULL;
+}
+
+static void free_plugins(struct wl_list *plugins)
+{
+	struct plugin *plugin;
+	struct plugin *tmp;
+	wl_list_for_each_safe(plugin, tmp, plugins, link) {
+		wl_list_remove(&plugin->link);
+		plugin_free(plugin);
+	}
+}
+
+static void assert_actions_equal(const struct action_def *expected, const struct action_def *actual)
+{
+	if (expected == NULL) {
+		TEST_ASSERT_NULL(actual);
+		return;
+	}
+	TEST_ASSERT_NOT_NULL(actual);
+	TEST_ASSERT_EQUAL_INT(expected->selection_type, actual->selection_type);
+	TEST_ASSERT_EQUAL_INT(expected->execution_type, actual->execution_type);
+	TEST_ASSERT_EQUAL_STRING(expected->template, actual->template);
+	TEST_ASSERT_EQUAL_STRING(expected->list_cmd, actual->list_cmd);
+	TEST_ASSERT_EQUAL_INT(expected->history_limit, actual->history_limit);
+	/* Templates are compiled as they're loaded, like parsed ones. */
+	TEST_ASSERT_EQUAL_INT(expected->compiled.template == NULL, actual->compiled.template == NULL);
+	assert_actions_equal(expected->on_select, actual->on_select);
+}
+
+static void assert_plugins_equal(const struct plugin *expected, const struct plugin *actual)
+{
+	TEST_ASSERT_NOT_NULL(expected);
+	TEST_ASSERT_EQUAL_STRING(expected->name, actual->name);
+	TEST_ASSERT_EQUAL_STRING(expected->display_prefix, actual->display_prefix);
+	TEST_ASSERT_EQUAL_INT(expected->global, actual->global);
+	TEST_ASSERT_EQUAL_SIZE(expected->depends_count, actual->depends_count);
+	for (size_t i = 0; i < expected->depends_count; i++) {
+		TEST_ASSERT_EQUAL_STRING(expected->depends[i], actual->depends[i]);
+	}
+	TEST_ASSERT_EQUAL_INT(expected->deps_satisfied, actual->deps_satisfied);
+	TEST_ASSERT_EQUAL_INT(expected->has_provider, actual->has_provider);
+	TEST_ASSERT_EQUAL_STRING(expected->list_cmd, actual->list_cmd);
+	TEST_ASSERT_EQUAL_INT(expected->format, actual->format);
+	TEST_ASSERT_EQUAL_STRING(expected->label_field, actual->label_field);
+	TEST_ASSERT_EQUAL_STRING(expected->value_field, actual->value_field);
+	TEST_ASSERT_EQUAL_INT(expected->cache.ttl, actual->cache.ttl);
+	TEST_ASSERT_EQUAL_STRING(expected->cache_key, actual->cache_key);
+	assert_actions_equal(expected->provider_action, actual->provider_action);
+	
+	TEST_ASSERT_EQUAL_INT(wl_list_length(&expected->actions), wl_list_length(&actual->actions));
+	const struct plugin_action *a = wl_container_of(actual->actions.next, a, link);
+	const struct plugin_action *e;
+	wl_list_for_each(e, &expected->actions, link) {
+		TEST_ASSERT_EQUAL_STRING(e->label, a->label);
+		assert_actions_equal(e->action, a->action);
+		a = wl_container_of(a->link.next, a, link);
+	}
+}
+
+static void test_round_trip(void)
+{
+	TEST_ASSERT_EQUAL_SIZE(2, plugin_count());
+	
+	struct wl_list loaded;
+	wl_list_init(&loaded);
+	TEST_ASSERT_TRUE(plugin_snapshot_load(dir, &loaded));
+	TEST_ASSERT_EQUAL_INT(2, wl_list_length(&loaded));
+	
+	struct plugin *plugin;
+	wl_list_for_each(plugin, &loaded, link) {
+		assert_plugins_equal(plugin_get(plugin->name), plugin);
+	}
+	TEST_ASSERT_TRUE(plugin_get("alpha")->deps_satisfied);
+	TEST_ASSERT_FALSE(plugin_get("beta")->deps_satisfied);
+	
+	free_plugins(&loaded);
+}
+
+static void test_reload_from_snapshot(void)
+{
+	plugin_destroy();
+	plugin_init();
+	plugin_load_directory(dir);
+	
+	TEST_ASSERT_EQUAL_SIZE(2, plugin_count());
+	struct plugin *alpha = plugin_get("alpha");
+	TEST_ASSERT_NOT_NULL(alpha);
+	TEST_ASSERT_EQUAL_STRING("open {value}", alpha->provider_action->on_select->template);
+	TEST_ASSERT_EQUAL_INT(60, alpha->cache.ttl);
+}
+
+static void test_changed_file(void)
+{
+	write_file("beta.toml", "name = \"beta\"\ndisplay_prefix = \"Beta\"\n");
+	
+	struct wl_list loaded;
+	wl_list_init(&loaded);
+	TEST_ASSERT_FALSE(plugin_snapshot_load(dir, &loaded));
+	TEST_ASSERT_TRUE(wl_list_empty(&loaded));
+}
+
+static void test_touched_file(void)
+{
+	/* Same size, so only the mtime gives it away. */
+	char path[sizeof(dir) + 32];
+	snprintf(path, sizeof(path), "%s/alpha.toml", dir);
+	struct timespec times[2] = {
+		{ .tv_sec = 12345, .tv_nsec = 0 },
+		{ .tv_sec = 12345, .tv_nsec = 0 },
+	};
+	TEST_ASSERT_TRUE(utimensat(AT_FDCWD, path, times, 0) == 0);
+	
+	struct wl_list loaded;
+	wl_list_init(&loaded);
+	TEST_ASSERT_FALSE(plugin_snapshot_load(dir, &loaded));
+}
+
+static void test_added_file(void)
+{
+	write_file("gamma.toml", "name = \"gamma\"\n");
+	
+	struct wl_list loaded;
+	wl_list_init(&loaded);
+	TEST_ASSERT_FALSE(plugin_snapshot_load(dir, &loaded));
+	
+	/* Loading the directory again picks it up, and saves a new snapshot. */
+	plugin_destroy();
+	plugin_init();
+	plugin_load_directory(dir);
+	TEST_ASSERT_NOT_NULL(plugin_get("gamma"));
+	TEST_ASSERT_TRUE(plugin_snapshot_load(dir, &loaded));
+	TEST_ASSERT_EQUAL_INT(3, wl_list_length(&loaded));
+	free_plugins(&loaded);
+}
+
+static void test_changed_path(void)
+{
+	char *path = strdup(getenv("PATH"));
+	setenv("PATH", cache, 1);
+	
+	struct wl_list loaded;
+	wl_list_init(&loaded);
+	bool valid = plugin_snapshot_load(dir, &loaded);
+	
+	setenv("PATH", path, 1);
+	free(path);
+	TEST_ASSERT_FALSE(valid);
+	free_plugins(&loaded);
+}
+
+int main(void)
+{
+	UnityBegin("test_plugin_snapshot.c");
+	
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_reload_from_snapshot);
+	RUN_TEST(test_changed_file);
+	RUN_TEST(test_touched_file);
+	RUN_TEST(test_added_file);
+	RUN_TEST(test_changed_path);
+	
+	return UnityEnd();
+}